@@ -164,6 +164,7 @@ public:
 		hit.point = rayOrigin + rayDirection * t;
 		hit.intersectedNode = node;
 		hit.distance = t;
+		return true;
 	}
 };
 
@@ -278,6 +279,11 @@ public:
 		return lowest;
 	}
 
+	const glm::vec3& getFirstMax() const
+	{
+		return highest;
+	}
+
 	float PlayerCollidesWithAABBSwept(const BoundingBox& box, glm::vec3& normal,const glm::vec3& velocity)
 	{
 		//the algorithm for the swept aabb collision that returns the time of entry in a frame and
@@ -431,3 +437,85 @@ public:
 		worldlowest += velocity;
 	}
 };
+
+//axis aligned box that encloses a whole subtree of the scene graph,
+//cached by the nodes so that a traversal can skip the subtree with one test
+struct Bounds
+{
+	glm::vec3 lowest;
+	glm::vec3 highest;
+	bool empty;
+
+	Bounds()
+	{
+		lowest = glm::vec3(0.0f);
+		highest = glm::vec3(0.0f);
+		empty = true;
+	}
+
+	Bounds(const glm::vec3& low, const glm::vec3& high)
+	{
+		lowest = low;
+		highest = high;
+		empty = false;
+	}
+
+	void Add(const glm::vec3& point)
+	{
+		if (empty)
+		{
+			lowest = highest = point;
+			empty = false;
+			return;
+		}
+		lowest = min(lowest, point);
+		highest = max(highest, point);
+	}
+
+	void Add(const Bounds& box)
+	{
+		if (box.empty)
+			return;
+		Add(box.lowest);
+		Add(box.highest);
+	}
+
+	//the box that encloses this one after the transformation
+	Bounds Transformed(const glm::mat4& model) const
+	{
+		Bounds result;
+		if (empty)
+			return result;
+
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec3 corner((i & 1) ? highest.x : lowest.x, (i & 2) ? highest.y : lowest.y, (i & 4) ? highest.z : lowest.z);
+			result.Add(glm::vec3(model * glm::vec4(corner, 1.0f)));
+		}
+		return result;
+	}
+
+	//slab test, true when the ray enters the box in front of its origin
+	bool IntersectsRay(const glm::vec3& rayOrigin, const glm::vec3& rayDirection) const
+	{
+		if (empty)
+			return false;
+
+		float tmin = 0.0f;
+		float tmax = std::numeric_limits<float>::infinity();
+		for (int a = 0; a < 3; a++)
+		{
+			if (rayDirection[a] == 0.0f)
+			{
+				if (rayOrigin[a] < lowest[a] || rayOrigin[a] > highest[a])
+					return false;
+				continue;
+			}
+			float t1 = (lowest[a] - rayOrigin[a]) / rayDirection[a];
+			float t2 = (highest[a] - rayOrigin[a]) / rayDirection[a];
+			tmin = max(tmin, min(t1, t2));
+			tmax = min(tmax, max(t1, t2));
+		}
+		return tmin <= tmax;
+	}
+};
\ No newline at end of file
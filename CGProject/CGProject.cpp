@@ -10,6 +10,7 @@
 #include <glm\gtc\type_ptr.hpp>
 
 #include <iostream>
+#include <cstdarg>
 
 #include "Shader.h"
 #include "Camera.h"
@@ -19,6 +20,16 @@
 #include "GroupNode.h"
 #include "TransformNode.h"
 #include "Skybox.h"
+#include "RenderQueue.h"
+#include "SceneBVH.h"
+#include "OcclusionCuller.h"
+#include "SoftwareOcclusion.h"
+#include "PortalCuller.h"
+#include "GpuTimer.h"
+#include "ShadowCache.h"
+#include "LightClusters.h"
+#include "ObjectLights.h"
+#include "GBuffer.h"
 
 
 
@@ -26,9 +37,20 @@ bool init();
 bool initGL();
 void render();
 void close();
-bool loadDepthcubemap(GLuint& depthID, GLuint& FBO);
 bool KelvintoRGB(glm::vec3& lightdiff, float temp);
+void ScreenPosToWorldRay(int mouseX, int mouseY, int viewportWidth, int viewportHeight,
+	glm::mat4 ViewMatrix, glm::mat4 ProjectionMatrix, glm::vec3& out_direction);
+float LightRange(const glm::vec3& attenuation, const glm::vec3& diffuse);
 void CreateScene();
+void CreateStressLights(unsigned int count);
+void UpdateStressLights(float time);
+void BeginLightBenchmarkFrame();
+void ReportShadowBenchmark();
+void Report(const char* format, ...);
+void SetLightingSamplers(Shader& shader);
+void SetLightingUniforms(Shader& shader, const glm::mat4& view, const glm::mat4& proj, float far_plane);
+void SelectLightingShaders();
+unsigned int ShadowedLampCount();
 
 //The window we'll be rendering to
 SDL_Window* gWindow = NULL;
@@ -36,22 +58,87 @@ SDL_Window* gWindow = NULL;
 //OpenGL context
 SDL_GLContext gContext;
 
-Shader gShader, gSkyBoxShader, gDeapthShader;
+Shader gShader, gSkyBoxShader, gDeapthShader, gOcclusionShader, gCullShader, gDepthPrePassShader, gDepthCutoutShader;
+//shadow shaders of the per face and vertex layer cube map paths, and of the dual-paraboloid maps
+Shader gShadowFaceShader, gShadowLayerShader, gShadowParaboloidShader, gShadowFilterShader;
+//G-buffer pass and full-screen lighting pass of the deferred path
+Shader gGBufferShader, gDeferredShader;
+//forward and deferred lighting shaders of the two shadow layouts, [0] samples the maps of the lamps and
+//[1] the atlas (SHADOW_ATLAS). gShader and gDeferredShader are set to the ones of the layout in use,
+//the packets read the program from gShader
+Shader gLayoutShaders[2], gDeferredLayoutShaders[2];
+
+//deferred shading instead of the forward main pass, chosen at startup with -deferred
+bool deferredShading = false;
+GBuffer gGBuffer;
 
 GroupNode* gRoot;
 
-SkyBox* skybox;
+//world space index of the geometry nodes, used for rendering, picking and collisions
+SceneBVH gSceneIndex;
 
-//shadows
-GLuint depthMapFBO1, depthMapFBO2, texIDDeapth1, texIDDeapth2;
-vector<GLuint> texIDDeapth;
-vector<GLuint> depthMapFBO;
-const unsigned int SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
+//draws of the current frame, shared by the shadow passes and the main pass
+RenderQueue gQueue;
 
-//lightSwitch
-bool shadow1 = false;
-bool shadow2 = false;
+//rooms and the openings between them
+PortalCuller gPortals;
+
+//occlusion queries on the boxes of the scene instances
+OcclusionCuller gOcclusion;
+//CPU rasterized occluders, tested before the main pass of the same frame
+SoftwareOcclusion gSoftwareOcclusion;
+
+SkyBox* skybox;
 
+//shadows, the cubemaps of the lights are only redrawn when they are stale
+ShadowCache gShadowCache;
+const unsigned int SHADOW_WIDTH = 1024, SHADOW_HEIGHT = 1024;
+//taps of the PCF kernel (1 to 20), adaptive takes 4 first and the rest only in the penumbras
+int shadowSamples = 20;
+bool adaptiveShadows = true;
+//cut off of the EVSM filter against light bleeding
+float lightBleeding = 0.2f;
+
+//unshadowed lights besides the two lamps, shaded per cluster of the view frustum
+LightClusters gClusters;
+//or per draw, from the lists of the lights whose range touches the bounds of the draw.
+//the lists also hold the lamps, which are skipped by the draws out of their range
+ObjectLights gObjectLights;
+LightAssignment lightAssignment = LIGHTS_CLUSTERED;
+//stress scene, key 6 steps through the light counts. the lights hang in rows through the room
+//and bob up and down so they are assigned again every frame
+const unsigned int STRESS_STEPS = 5;
+const unsigned int STRESS_LIGHTS[STRESS_STEPS] = { 0, 16, 64, 256, 1024 };
+unsigned int stressStep = 0;
+vector<glm::vec3> stressLightOrigins;
+//times the main pass for every light count with and without the clusters, -1 when not running
+const unsigned int LIGHT_BENCHMARK_FRAMES = 120;
+int lightBenchmarkFrame = -1;
+unsigned int lightBenchmarkRestore = 0;
+GpuTimer gLightBenchmarkTimers[STRESS_STEPS][LIGHT_ASSIGNMENTS];
+float lightBenchmarkAssign[STRESS_STEPS][LIGHT_ASSIGNMENTS];
+
+//lightSwitch, one per lamp
+vector<bool> lampOn;
+//lamps the lighting shaders without the atlas have map samplers for, the wall lamps after them
+//are only shadowed through the atlas
+const unsigned int MAP_LAMPS = 2;
+const unsigned int WALL_LAMPS = 6;
+
+
+//culling stats in the window title
+bool showStats = false;
+//last line of Report, shown after the stats for REPORT_MS
+char lastReport[256] = "";
+unsigned int lastReportTicks = 0;
+const unsigned int REPORT_MS = 5000;
+
+//depth only pass before the shading pass, so every pixel is shaded once
+bool depthPrePass = false;
+//GPU time of the depth pre-pass, and of the shading pass without [0] and with [1] the pre-pass,
+//for each shadow filter
+GpuTimer gDepthTimer;
+GpuTimer gShadingTimer[2][SHADOW_FILTERS];
 
 //lamp color
 float kelvin1 = 2000.0f;
@@ -99,11 +186,13 @@ float lastFrame = 0.0f;
 // lighting
 vector<glm::vec3> pointLightPositions;
 vector<glm::vec3> lightdiff;
+//constant, linear and quadratic attenuation factors
+vector<glm::vec3> lightAttenuation;
 float ambientLight = 0.9f;
 
 //statics
 unsigned int Node::genID;
-glm::mat4 TransformNode::transformMatrix = glm::mat4(1.0f);
+vector<TransformNode*> TransformNode::moved;
 
 TransformNode* selectedTransform;
 
@@ -117,9 +206,17 @@ void HandleMouseButtonUp(const SDL_MouseButtonEvent& button);
 
 int main(int argc, char* args[])
 {
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(args[i], "-deferred") == 0)
+			deferredShading = true;
+	}
+
 	init();
 
 	CreateScene();
+	gSceneIndex.Build(gRoot);
+	gPortals.Build(gSceneIndex);
 
 	SDL_Event e;
 	//While application is running
@@ -186,16 +283,16 @@ void HandleKeyDown(const SDL_KeyboardEvent& key)
 	switch (key.keysym.sym)
 	{
 	case SDLK_w:
-		camera.ProcessKeyboard(FORWARD, deltaTime, gRoot);
+		camera.ProcessKeyboard(FORWARD, deltaTime, gSceneIndex);
 		break;
 	case SDLK_s:
-		camera.ProcessKeyboard(BACKWARD, deltaTime, gRoot);
+		camera.ProcessKeyboard(BACKWARD, deltaTime, gSceneIndex);
 		break;
 	case SDLK_a:
-		camera.ProcessKeyboard(LEFT, deltaTime, gRoot);
+		camera.ProcessKeyboard(LEFT, deltaTime, gSceneIndex);
 		break;
 	case SDLK_d:
-		camera.ProcessKeyboard(RIGHT, deltaTime, gRoot);
+		camera.ProcessKeyboard(RIGHT, deltaTime, gSceneIndex);
 		break;
 	case SDLK_RIGHT://for the small lamp
 		if(kelvin1 < 3000.0f)
@@ -226,11 +323,33 @@ void HandleKeyDown(const SDL_KeyboardEvent& key)
 		}
 		break;
 	case SDLK_1://puts on and off the small lamp
-		shadow1 = shadow1 ? false : true;
+		lampOn[0] = !lampOn[0];
 		break;
 	case SDLK_2://puts on and off the big lamp
-		shadow2 = shadow2 ? false : true;
+		lampOn[1] = !lampOn[1];
+		break;
+	case SDLK_0://puts on and off the wall lamps, they need the shadow atlas
+	{
+		bool on = !lampOn[MAP_LAMPS];
+		for (unsigned int i = MAP_LAMPS; i < lampOn.size(); i++)
+			lampOn[i] = on;
+		Report("wall lamps %s%s", on ? "on" : "off", on && !gShadowCache.IsAtlas() ? ", they are dark without the shadow atlas" : "");
 		break;
+	}
+	case SDLK_3://cube or dual-paraboloid shadows for the small lamp
+	case SDLK_4://cube or dual-paraboloid shadows for the big lamp
+	{
+		unsigned int light = key.keysym.sym == SDLK_3 ? 0 : 1;
+		if (gShadowCache.IsAtlas())
+		{
+			Report("the shadow atlas only holds cube shadows");
+			break;
+		}
+		gShadowCache.SetMapType(light, gShadowCache.GetMapType(light) == SHADOW_CUBE ? SHADOW_PARABOLOID : SHADOW_CUBE);
+		Report("light %u: %s shadows, %.1f MB", light, gShadowCache.GetMapType(light) == SHADOW_CUBE ? "cube" : "dual-paraboloid",
+			gShadowCache.GetMemory(light) / (1024.0f * 1024.0f));
+		break;
+	}
 	case SDLK_r://daytime
 		skybox->ReLoadTextures(faces1);
 		ambientLight = 0.9f;
@@ -243,6 +362,136 @@ void HandleKeyDown(const SDL_KeyboardEvent& key)
 		skybox->ReLoadTextures(faces3);
 		ambientLight = 0.1f;
 		break;
+	case SDLK_F1://shows the visible and culled draws in the window title
+		showStats = !showStats;
+		if (!showStats)
+			SDL_SetWindowTitle(gWindow, "Small Room");
+		break;
+	case SDLK_F2://frustum culling on and off
+		gQueue.SetCulling(!gQueue.GetCulling());
+		Report("frustum culling %s", gQueue.GetCulling() ? "on" : "off");
+		break;
+	case SDLK_F3://occlusion queries on and off
+		gOcclusion.SetEnabled(!gOcclusion.IsEnabled());
+		Report("occlusion culling %s", gOcclusion.IsEnabled() ? "on" : "off");
+		break;
+	case SDLK_F4://software occlusion culling on and off
+		gSoftwareOcclusion.SetEnabled(!gSoftwareOcclusion.IsEnabled());
+		Report("software occlusion culling %s", gSoftwareOcclusion.IsEnabled() ? "on" : "off");
+		break;
+	case SDLK_F5://writes the software occlusion depth buffer
+		gSoftwareOcclusion.DumpDepth("occlusion.pgm");
+		break;
+	case SDLK_F6://portal culling on and off
+		gPortals.SetEnabled(!gPortals.IsEnabled());
+		Report("portal culling %s", gPortals.IsEnabled() ? "on" : "off");
+		break;
+	case SDLK_F7://compute shader culling of the main pass on and off (GL 4.3)
+		gQueue.SetGpuCulling(!gQueue.GetGpuCulling());
+		Report("gpu culling %s", gQueue.GetGpuCulling() ? "on" : "off");
+		break;
+	case SDLK_F8://depth pre-pass on and off, reports the main pass times measured so far
+	{
+		depthPrePass = !depthPrePass;
+		ShadowFilter filter = gShadowCache.GetFilter();
+		Report("depth pre-pass %s (main pass: %.2f ms without, %.2f + %.2f ms with)", depthPrePass ? "on" : "off",
+			gShadingTimer[0][filter].GetAverage(), gDepthTimer.GetAverage(), gShadingTimer[1][filter].GetAverage());
+		break;
+	}
+	case SDLK_F9://time sliced shadow map updates on and off
+		gShadowCache.SetTimeSliced(!gShadowCache.IsTimeSliced());
+		Report("time sliced shadows %s, %u faces per frame", gShadowCache.IsTimeSliced() ? "on" : "off", gShadowCache.GetFaceBudget());
+		break;
+	case SDLK_PAGEUP://more shadow faces per frame in time sliced mode
+		gShadowCache.SetFaceBudget(gShadowCache.GetFaceBudget() + 1);
+		Report("shadow face budget %u", gShadowCache.GetFaceBudget());
+		break;
+	case SDLK_PAGEDOWN://fewer shadow faces per frame in time sliced mode
+		gShadowCache.SetFaceBudget(gShadowCache.GetFaceBudget() - 1);
+		Report("shadow face budget %u", gShadowCache.GetFaceBudget());
+		break;
+	case SDLK_F10://next cube shadow path (geometry shader, per face passes, vertex shader layer)
+	{
+		ShadowPath path = gShadowCache.GetPath();
+		do
+			path = (ShadowPath)((path + 1) % SHADOW_PATHS);
+		while (!gShadowCache.IsPathSupported(path));
+		gShadowCache.SetPath(path);
+		Report("shadow path: %s", ShadowCache::GetPathName(path));
+		break;
+	}
+	case SDLK_F11://times the cube shadow paths and the dual-paraboloids, reports the results
+		if (gShadowCache.IsAtlas())
+		{
+			Report("the shadow benchmark times the maps of the lamps, the atlas is on");
+			break;
+		}
+		gShadowCache.StartBenchmark();
+		Report("shadow benchmark started");
+		break;
+	case SDLK_6://next light count of the stress scene
+		stressStep = (stressStep + 1) % STRESS_STEPS;
+		CreateStressLights(STRESS_LIGHTS[stressStep]);
+		Report("%u stress lights", STRESS_LIGHTS[stressStep]);
+		break;
+	case SDLK_7://clustered, per object or all lights per fragment
+		lightAssignment = (LightAssignment)((lightAssignment + 1) % LIGHT_ASSIGNMENTS);
+		Report("lights: %s", ObjectLights::GetAssignmentName(lightAssignment));
+		break;
+	case SDLK_8://times the main pass for every stress light count and every way of assigning the lights
+		if (lightBenchmarkFrame < 0)
+		{
+			lightBenchmarkRestore = stressStep;
+			lightBenchmarkFrame = 0;
+			Report("lighting benchmark started");
+		}
+		break;
+	case SDLK_9://cube shadows in the atlas, at the resolution their range earns on screen
+		if (!gShadowCache.IsAtlasSupported())
+			break;
+		gShadowCache.SetAtlas(!gShadowCache.IsAtlas());
+		SelectLightingShaders();
+		Report("shadow atlas %s, %u lamps shadowed", gShadowCache.IsAtlas() ? "on" : "off", ShadowedLampCount());
+		break;
+	case SDLK_5://pcf or evsm filtered cube shadows, reports the costs of both measured so far
+	{
+		ShadowFilter filter = gShadowCache.GetFilter() == SHADOW_FILTER_PCF ? SHADOW_FILTER_EVSM : SHADOW_FILTER_PCF;
+		if (!gShadowCache.IsFilterSupported(filter))
+			break;
+		gShadowCache.SetFilter(filter);
+		Report("%s cube shadows (main pass: %.2f ms pcf, %.2f ms evsm, evsm filtering %.2f ms per update)",
+			ShadowCache::GetFilterName(filter), gShadingTimer[depthPrePass][SHADOW_FILTER_PCF].GetAverage(),
+			gShadingTimer[depthPrePass][SHADOW_FILTER_EVSM].GetAverage(), gShadowCache.GetFilterTime());
+		break;
+	}
+	case SDLK_MINUS://less light bleeding reduction (evsm)
+		lightBleeding = max(lightBleeding - 0.05f, 0.0f);
+		Report("light bleeding reduction %.2f", lightBleeding);
+		break;
+	case SDLK_EQUALS://more light bleeding reduction (evsm)
+		lightBleeding = min(lightBleeding + 0.05f, 0.9f);
+		Report("light bleeding reduction %.2f", lightBleeding);
+		break;
+	case SDLK_COMMA://narrower evsm blur
+		gShadowCache.SetFilterRadius(gShadowCache.GetFilterRadius() - 1);
+		Report("evsm blur radius %u", gShadowCache.GetFilterRadius());
+		break;
+	case SDLK_PERIOD://wider evsm blur
+		gShadowCache.SetFilterRadius(gShadowCache.GetFilterRadius() + 1);
+		Report("evsm blur radius %u", gShadowCache.GetFilterRadius());
+		break;
+	case SDLK_F12://adaptive shadow sampling on and off
+		adaptiveShadows = !adaptiveShadows;
+		Report("adaptive shadow sampling %s, %d samples", adaptiveShadows ? "on" : "off", shadowSamples);
+		break;
+	case SDLK_LEFTBRACKET://fewer shadow samples
+		shadowSamples = max(shadowSamples - 1, 1);
+		Report("shadow samples %d", shadowSamples);
+		break;
+	case SDLK_RIGHTBRACKET://more shadow samples
+		shadowSamples = min(shadowSamples + 1, 20);
+		Report("shadow samples %d", shadowSamples);
+		break;
 	}
 }
 
@@ -269,7 +518,33 @@ void HandleMouseWheel(const SDL_MouseWheelEvent& wheel)
 
 void HandleMouseButtonUp(const SDL_MouseButtonEvent& button)
 {
-	
+	if (button.clicks == 1 && button.button == SDL_BUTTON_LEFT)
+	{
+		int width, height;
+		SDL_GetWindowSize(gWindow, &width, &height);
+
+		glm::mat4 proj = glm::perspective(glm::radians(camera.Zoom), 4.0f / 3.0f, 0.1f, 100.0f);
+		glm::vec3 rayDirection;
+		ScreenPosToWorldRay(button.x, button.y, width, height, camera.GetViewMatrix(), proj, rayDirection);
+
+		//only the instances along the ray are tested
+		std::vector<Intersection*> hits;
+		gSceneIndex.Intersections(camera.Position, rayDirection, hits);
+		int minIx = -1;
+		for (unsigned int i = 0; i < hits.size(); i++)
+		{
+			Node* parent = hits[i]->path[hits[i]->path.size() - 1];
+			if (parent->GetType() == nt_TransformNode && (minIx < 0 || hits[i]->distance <= hits[minIx]->distance))
+				minIx = i;
+		}
+		if (minIx >= 0)
+		{
+			selectedTransform = (TransformNode*)hits[minIx]->path[hits[minIx]->path.size() - 1];
+			Report("selected: %s (%s)", hits[minIx]->intersectedNode->GetName().c_str(), selectedTransform->GetName().c_str());
+		}
+		for (unsigned int i = 0; i < hits.size(); i++)
+			delete hits[i];
+	}
 }
 
 
@@ -287,9 +562,9 @@ bool init()
 	}
 	else
 	{
-		//Use OpenGL 3.3
+		//Use OpenGL 4.3 (multi draw indirect) when available, 3.3 otherwise
 		SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 4);
 		SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
 
 
@@ -306,6 +581,12 @@ bool init()
 			//Create context
 			gContext = SDL_GL_CreateContext(gWindow);
 			if (gContext == NULL)
+			{
+				SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+				SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+				gContext = SDL_GL_CreateContext(gWindow);
+			}
+			if (gContext == NULL)
 			{
 				printf("OpenGL context could not be created! SDL Error: %s\n", SDL_GetError());
 				success = false;
@@ -336,57 +617,161 @@ bool initGL()
 	bool success = true;
 	GLenum error = GL_NO_ERROR;
 
-	glewInit();
+	//needed for the extension entry points (ARB_buffer_storage) on core profile contexts
+	glewExperimental = GL_TRUE;
+	GLenum glewError = glewInit();
+	if (glewError != GLEW_OK)
+	{
+		success = false;
+		printf("Error initializing GLEW! %s\n", glewGetErrorString(glewError));
+	}
 
+	//glewInit queries the extension string the pre 3.0 way, which leaves a GL_INVALID_ENUM behind on
+	//core contexts. only that error is expected, anything else is still reported
 	error = glGetError();
+	if (error == GL_INVALID_ENUM)
+		error = glGetError();
 	if (error != GL_NO_ERROR)
 	{
 		success = false;
 		printf("Error initializing OpenGL! %s\n", gluErrorString(error));
 	}
 
+	gQueue.SetMultiDraw(GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect);
+	Report("OpenGL %s, %s", (const char*)glGetString(GL_VERSION), gQueue.GetMultiDraw() ? "multi draw indirect" : "instanced draw fallback");
+
 	glClearColor(0.0f, 0.5f, 0.0f, 1.0f);
 	glEnable(GL_DEPTH_TEST);
 
-	glEnable(GL_BLEND);
+	//blending is only switched on for the transparent draws at the end of the frame
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	gShader.Load("./shaders/vertex.vert", "./shaders/fragment.frag");
+	//the lighting shaders of the atlas layout sample cube map arrays
+	bool shadowAtlas = GLEW_VERSION_4_0 || GLEW_ARB_texture_cube_map_array;
+	string atlasDefines = "#extension GL_ARB_texture_cube_map_array : enable\n#define SHADOW_ATLAS\n";
+	gLayoutShaders[0].Load("./shaders/vertex.vert", "./shaders/fragment.frag");
+	if (shadowAtlas)
+		gLayoutShaders[1].Load("./shaders/vertex.vert", "./shaders/fragment.frag", nullptr, atlasDefines.c_str());
 	gSkyBoxShader.Load("./shaders/skybox.vert", "./shaders/skybox.frag");
 	gDeapthShader.Load("./shaders/shadowdepth.vert", "./shaders/shadowdepth.frag", "./shaders/shadowdepth.geo");
+	gShadowFaceShader.Load("./shaders/shadowdepth_face.vert", "./shaders/shadowdepth.frag");
+	gShadowParaboloidShader.Load("./shaders/shadowdepth.vert", "./shaders/shadowdepth.frag", "./shaders/shadowdepth_paraboloid.geo");
+	gShadowFilterShader.Load("./shaders/shadowfilter.vert", "./shaders/shadowfilter.frag");
+	if (deferredShading)
+	{
+		gGBufferShader.Load("./shaders/vertex.vert", "./shaders/gbuffer.frag");
+		gDeferredLayoutShaders[0].Load("./shaders/deferred.vert", "./shaders/fragment.frag", nullptr, "#define DEFERRED");
+		if (shadowAtlas)
+			gDeferredLayoutShaders[1].Load("./shaders/deferred.vert", "./shaders/fragment.frag", nullptr, (atlasDefines + "#define DEFERRED").c_str());
+		if (!gGBuffer.Init(1200, 900))
+			deferredShading = false;
+	}
+	Report("%s shading", deferredShading ? "deferred" : "forward");
+	bool vertexLayer = GLEW_ARB_shader_viewport_layer_array || GLEW_AMD_vertex_shader_layer;
+	if (vertexLayer)
+		gShadowLayerShader.Load("./shaders/shadowdepth_layer.vert", "./shaders/shadowdepth.frag");
+	gOcclusionShader.Load("./shaders/occlusion.vert", "./shaders/occlusion.frag");
+	gDepthPrePassShader.Load("./shaders/depthprepass.vert", "./shaders/depthprepass.frag");
+	gDepthCutoutShader.Load("./shaders/depthprepass.vert", "./shaders/depthprepass.frag", nullptr, "#define ALPHA_TEST\n");
+	if (gQueue.GetMultiDraw() && (GLEW_VERSION_4_3 || GLEW_ARB_compute_shader))
+	{
+		gCullShader.LoadCompute("./shaders/cull.comp");
+		gQueue.InitGpuCulling(&gCullShader);
+		Report("gpu culling available%s", gQueue.IsGpuCompacting() ? " (with command compaction)" : "");
+	}
+
+	//cheapest test first
+	gQueue.AddOcclusionTest(&gPortals);
+
+	gOcclusion.Init(&gOcclusionShader);
+	gQueue.AddOcclusionTest(&gOcclusion);
+
+	//leave one core to the main thread
+	unsigned int cores = std::thread::hardware_concurrency();
+	gSoftwareOcclusion.Init(cores > 2 ? min(cores - 1, 4u) : 1);
+	gQueue.AddOcclusionTest(&gSoftwareOcclusion);
 
 	pointLightPositions.push_back(glm::vec3(2.0f, 2.3f, -1.2f));
 	pointLightPositions.push_back(glm::vec3(-1.0f, 5.0f, 2.0f));
 
+	lightAttenuation.push_back(glm::vec3(1.0f, 0.14f, 0.07f));
+	lightAttenuation.push_back(glm::vec3(1.0f, 0.07f, 0.017f));
+
+	//the wall lamps hang in pairs on the long walls, dim and warm with a short range
+	for (unsigned int i = 0; i < WALL_LAMPS; i++)
+	{
+		pointLightPositions.push_back(glm::vec3(i % 2 == 0 ? -4.3f : 3.9f, 3.2f, -1.5f + 3.6f * (i / 2)));
+		lightAttenuation.push_back(glm::vec3(1.0f, 0.7f, 1.8f));
+	}
+	lampOn.assign(pointLightPositions.size(), false);
+
 
 	skybox = new SkyBox();
 	skybox->SetShader(&gSkyBoxShader);
 	skybox->LoadTextures(faces1);
 
-	loadDepthcubemap(texIDDeapth1, depthMapFBO1);
-	loadDepthcubemap(texIDDeapth2, depthMapFBO2);
+	gClusters.Init();
+	gObjectLights.Init();
+	gQueue.SetObjectLights(&gObjectLights);
 
+	gShadowCache.Init(pointLightPositions.size(), SHADOW_WIDTH, &gDeapthShader, &gShadowFaceShader,
+		vertexLayer ? &gShadowLayerShader : NULL, &gShadowParaboloidShader, &gShadowFilterShader);
 
-	depthMapFBO.push_back(depthMapFBO1);
-	depthMapFBO.push_back(depthMapFBO2);
+	for (unsigned int l = 0; l < 2; l++)
+	{
+		if (gLayoutShaders[l].ID == 0)
+			continue;
+		SetLightingSamplers(gLayoutShaders[l]);
+		gLayoutShaders[l].setInt("drawData", DRAW_DATA_TEXTURE_UNIT);
+		if (!deferredShading)
+			continue;
+		Shader& deferred = gDeferredLayoutShaders[l];
+		SetLightingSamplers(deferred);
+		deferred.setInt("gAlbedo", GBUFFER_TEXTURE_UNIT);
+		deferred.setInt("gNormal", GBUFFER_TEXTURE_UNIT + 1);
+		deferred.setInt("gSpecular", GBUFFER_TEXTURE_UNIT + 2);
+		deferred.setInt("gDepth", GBUFFER_TEXTURE_UNIT + 3);
+	}
+	SelectLightingShaders();
+	if (deferredShading)
+	{
+		glUseProgram(gGBufferShader.ID);
+		gGBufferShader.setInt("drawData", DRAW_DATA_TEXTURE_UNIT);
+	}
 
-	texIDDeapth.push_back(texIDDeapth1);
-	texIDDeapth.push_back(texIDDeapth2);
+	glUseProgram(gDeapthShader.ID);
+	gDeapthShader.setInt("drawData", DRAW_DATA_TEXTURE_UNIT);
 
-	glUseProgram(gShader.ID);
+	glUseProgram(gShadowFaceShader.ID);
+	gShadowFaceShader.setInt("drawData", DRAW_DATA_TEXTURE_UNIT);
 
-	gShader.setInt("depthMap[0]", 3);
-	gShader.setInt("depthMap[1]", 4);
+	glUseProgram(gShadowParaboloidShader.ID);
+	gShadowParaboloidShader.setInt("drawData", DRAW_DATA_TEXTURE_UNIT);
+
+	if (vertexLayer)
+	{
+		glUseProgram(gShadowLayerShader.ID);
+		gShadowLayerShader.setInt("drawData", DRAW_DATA_TEXTURE_UNIT);
+	}
+
+	glUseProgram(gDepthPrePassShader.ID);
+	gDepthPrePassShader.setInt("drawData", DRAW_DATA_TEXTURE_UNIT);
+	glUseProgram(gDepthCutoutShader.ID);
+	gDepthCutoutShader.setInt("drawData", DRAW_DATA_TEXTURE_UNIT);
 
 	//setup lightning color
 	glm::vec3 light1 = glm::vec3(0.0f);
 	glm::vec3 light2 = glm::vec3(0.0f);
+	glm::vec3 wallLight = glm::vec3(0.0f);
 
 	KelvintoRGB(light1, kelvin1);
 	KelvintoRGB(light2, kelvin2);
+	KelvintoRGB(wallLight, 2700.0f);
 
 	lightdiff.push_back(light1);
 	lightdiff.push_back(light2);
+	for (unsigned int i = 0; i < WALL_LAMPS; i++)
+		lightdiff.push_back(wallLight);
 
 
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL); //other modes GL_FILL, GL_POINT
@@ -511,6 +896,11 @@ void CreateScene()
 	window->SetShader(&gShader);
 	window->SetShadowShader(&gDeapthShader);
 
+	//the walls and the floor hide most of the room from itself
+	wall1->SetOccluder(true);
+	wall2->SetOccluder(true);
+	floor->SetOccluder(true);
+
 	tr->AddChild(wall1);
 	gRoot->AddChild(tr);
 
@@ -549,16 +939,57 @@ void CreateScene()
 
 	w2->AddChild(window);
 	gRoot->AddChild(w2);
+
+	//the room is the space between the walls, the windows open it to the outside
+	unsigned int outside = gPortals.AddCell("outside", glm::vec3(-1000.0f), glm::vec3(1000.0f));
+	unsigned int room = gPortals.AddCell("room", glm::vec3(-5.0f, 0.0f, -3.0f), glm::vec3(4.6f, 5.0f, 7.2f));
+	gPortals.AddPortal(room, outside, w);
+	gPortals.AddPortal(room, outside, w2);
 }
 
 void close()
 {
 	//delete GL programs, buffers and objects
-	glDeleteProgram(gShader.ID);
+	gQueue.Release();
+	gOcclusion.Release();
+	gSoftwareOcclusion.Release();
+	GeometryArena::Get().Release();
+	for (unsigned int l = 0; l < 2; l++)
+	{
+		if (gLayoutShaders[l].ID != 0)
+			glDeleteProgram(gLayoutShaders[l].ID);
+		if (gDeferredLayoutShaders[l].ID != 0)
+			glDeleteProgram(gDeferredLayoutShaders[l].ID);
+	}
+	glDeleteProgram(gOcclusionShader.ID);
+	glDeleteProgram(gDepthPrePassShader.ID);
+	glDeleteProgram(gDepthCutoutShader.ID);
+	gDepthTimer.Release();
+	for (unsigned int f = 0; f < SHADOW_FILTERS; f++)
+	{
+		gShadingTimer[0][f].Release();
+		gShadingTimer[1][f].Release();
+	}
+	if (gCullShader.ID != 0)
+		glDeleteProgram(gCullShader.ID);
 	glDeleteProgram(gSkyBoxShader.ID);
 	glDeleteProgram(gDeapthShader.ID);
-	glDeleteFramebuffers(1, &depthMapFBO1);
-	glDeleteFramebuffers(1, &depthMapFBO2);
+	glDeleteProgram(gShadowFaceShader.ID);
+	glDeleteProgram(gShadowParaboloidShader.ID);
+	glDeleteProgram(gShadowFilterShader.ID);
+	if (gShadowLayerShader.ID != 0)
+		glDeleteProgram(gShadowLayerShader.ID);
+	gShadowCache.Release();
+	gClusters.Release();
+	gObjectLights.Release();
+	gGBuffer.Release();
+	if (gGBufferShader.ID != 0)
+		glDeleteProgram(gGBufferShader.ID);
+	for (unsigned int n = 0; n < STRESS_STEPS; n++)
+	{
+		for (unsigned int a = 0; a < LIGHT_ASSIGNMENTS; a++)
+			gLightBenchmarkTimers[n][a].Release();
+	}
 
 
 
@@ -581,33 +1012,131 @@ void render()
 	//Clear color buffer
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	
+	glm::mat4 view = camera.GetViewMatrix();
+	glm::mat4 proj = glm::perspective(glm::radians(camera.Zoom), 4.0f / 3.0f, 0.1f, 100.0f);
+
+	gSceneIndex.Refit();
+	gPortals.Update(camera.Position, Frustum(proj * view));
+
+	//the occluders are rasterized on the worker threads while the draws are collected below
+	if (gSoftwareOcclusion.IsEnabled())
+	{
+		gSoftwareOcclusion.Begin(proj * view);
+		gSceneIndex.SubmitOccluders(gSoftwareOcclusion, Frustum(proj * view));
+		gSoftwareOcclusion.Rasterize();
+	}
 
+	gOcclusion.BeginFrame();
+	gShadowCache.BeginFrame();
+	if (gShadowCache.TakeBenchmarkResults())
+		ReportShadowBenchmark();
+	BeginLightBenchmarkFrame();
+	gQueue.SetShadowPath(gShadowCache.GetPath());
+	gQueue.Clear();
+	gQueue.SetView(camera.Position, far_plane);
+	gQueue.SetFrustum(Frustum(proj * view));
+
+	//the cube faces of every switched on lamp, casters are culled per face and by the range of the light.
+	//lamps that are off, or have no samplers without the atlas, get no view and their maps are left as they are
+	unsigned int lampCount = ShadowedLampCount();
+	vector<ShadowView> shadowViews(pointLightPositions.size());
+	vector<int> lightViews;
 	for (int i = 0;i < pointLightPositions.size();i++)
-	 {
+	{
+		if (i >= lampCount || !lampOn[i])
+		{
+			lightViews.push_back(-1);
+			continue;
+		}
 		glm::mat4 shadowProj = glm::perspective(glm::radians(90.0f), (float)SHADOW_WIDTH / (float)SHADOW_HEIGHT, near_plane, far_plane);
-		std::vector<glm::mat4> shadowTransforms;
-		shadowTransforms.push_back(shadowProj * glm::lookAt(pointLightPositions[i], pointLightPositions[i] + glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-		shadowTransforms.push_back(shadowProj * glm::lookAt(pointLightPositions[i], pointLightPositions[i] + glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-		shadowTransforms.push_back(shadowProj * glm::lookAt(pointLightPositions[i], pointLightPositions[i] + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)));
-		shadowTransforms.push_back(shadowProj * glm::lookAt(pointLightPositions[i], pointLightPositions[i] + glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)));
-		shadowTransforms.push_back(shadowProj * glm::lookAt(pointLightPositions[i], pointLightPositions[i] + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
-		shadowTransforms.push_back(shadowProj * glm::lookAt(pointLightPositions[i], pointLightPositions[i] + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f)));
+		shadowViews[i].position = pointLightPositions[i];
+		shadowViews[i].range = LightRange(lightAttenuation[i], lightdiff[i]);
+		shadowViews[i].faces[0] = shadowProj * glm::lookAt(pointLightPositions[i], pointLightPositions[i] + glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+		shadowViews[i].faces[1] = shadowProj * glm::lookAt(pointLightPositions[i], pointLightPositions[i] + glm::vec3(-1.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+		shadowViews[i].faces[2] = shadowProj * glm::lookAt(pointLightPositions[i], pointLightPositions[i] + glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+		shadowViews[i].faces[3] = shadowProj * glm::lookAt(pointLightPositions[i], pointLightPositions[i] + glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f));
+		shadowViews[i].faces[4] = shadowProj * glm::lookAt(pointLightPositions[i], pointLightPositions[i] + glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+		shadowViews[i].faces[5] = shadowProj * glm::lookAt(pointLightPositions[i], pointLightPositions[i] + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+		lightViews.push_back(gQueue.AddShadowView(shadowViews[i]));
+	}
 
-		glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-		glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO[i]);
-		glClear(GL_DEPTH_BUFFER_BIT);
-		glUseProgram(gDeapthShader.ID);
-		for (unsigned int i = 0; i < 6; ++i)
-			gDeapthShader.setMat4("shadowMatrices[" + std::to_string(i) + "]", shadowTransforms[i]);
+	//the scene index finds the objects in range of each light, the queue lists them per visible object.
+	//the unshadowed lights are only listed when the shaders read them from the lists
+	UpdateStressLights(SDL_GetTicks() / 1000.0f);
+	vector<glm::vec4> lampSpheres;
+	for (int i = 0;i < pointLightPositions.size();i++)
+		lampSpheres.push_back(glm::vec4(pointLightPositions[i], lightViews[i] >= 0 ? shadowViews[i].range : 0.0f));
+	gObjectLights.SetLamps(lampSpheres);
+	gObjectLights.SetLights(lightAssignment == LIGHTS_PER_OBJECT ? &gClusters.GetLights() : NULL);
+	gSceneIndex.SubmitLights(gObjectLights);
 
-		gDeapthShader.setFloat("far_plane", far_plane);
-		gDeapthShader.setVec3("lightPos", pointLightPositions[i]);
+	//collect the draws once, the packets are replayed by every pass below.
+	//the index skips everything that is neither in view nor in the range of a light
+	gSceneIndex.Submit(gQueue);
+	gQueue.Sort();
 
-		gRoot->TraverseShadows();
+	if (showStats)
+	{
+		//casters per cube face (+x -x +y -y +z -z) of each light
+		char title[2048];
+		int length = sprintf(title, "Small Room - draws: %u visible, %u culled", gQueue.GetVisibleCount(), gQueue.GetCulledCount());
+		if (gQueue.GetGpuCulling())
+			length += sprintf(title + length, " (main pass culled on the gpu)");
+		if (gQueue.GetDroppedCount() > 0)
+			length += sprintf(title + length, " (%u dropped, out of draw records)", gQueue.GetDroppedCount());
+		if (gPortals.IsEnabled())
+			length += sprintf(title + length, " | in %s, %u/%u cells, %u instances",
+				gPortals.GetCameraCellName(), gPortals.GetReachedCount(), gPortals.GetCellCount(), gPortals.GetVisibleCount());
+		if (gOcclusion.IsEnabled())
+			length += sprintf(title + length, " | occluded %u/%u, query latency %.1f frames",
+				gOcclusion.GetOccludedCount(), gOcclusion.GetTestedCount(), gOcclusion.GetAverageLatency());
+		if (gSoftwareOcclusion.IsEnabled())
+			length += sprintf(title + length, " | cpu occlusion: %u hidden, %u tris in %.2f ms",
+				gSoftwareOcclusion.GetOccludedCount(), gSoftwareOcclusion.GetTriangleCount(), gSoftwareOcclusion.GetRasterTime());
+		ShadowFilter filter = gShadowCache.GetFilter();
+		length += sprintf(title + length, " | %s main pass %.2f ms without pre-pass, %.2f + %.2f ms with", deferredShading ? "deferred" : "forward",
+			gShadingTimer[0][filter].GetAverage(), gDepthTimer.GetAverage(), gShadingTimer[1][filter].GetAverage());
+		for (unsigned int i = 0; i < lightViews.size(); i++)
+		{
+			if (lightViews[i] < 0)
+				continue;
+			length += sprintf(title + length, " | light %u (%s, %.0f MB) casters:", i,
+				gShadowCache.GetMapType(i) == SHADOW_CUBE ? "cube" : "paraboloid", gShadowCache.GetMemory(i) / (1024.0f * 1024.0f));
+			if (gShadowCache.GetAtlasTier(i) >= 0)
+				length += sprintf(title + length, " (atlas %upx slot %d)", gShadowCache.GetAtlasSize(gShadowCache.GetAtlasTier(i)), gShadowCache.GetAtlasSlot(i));
+			for (unsigned int f = 0; f < 6; f++)
+				length += sprintf(title + length, " %u", gQueue.GetShadowCasters(lightViews[i], f));
+			length += sprintf(title + length, " (%u dynamic)", gQueue.GetShadowCasterCount(lightViews[i], SHADOW_DYNAMIC));
+		}
+		length += sprintf(title + length, " | %u lights %s, %.1f per cluster (max %u), assigned in %.2f ms", gClusters.GetLightCount(),
+			ObjectLights::GetAssignmentName(lightAssignment), gClusters.GetAverageLights(), gClusters.GetMaxLights(), gClusters.GetAssignTime());
+		if (lightAssignment == LIGHTS_PER_OBJECT)
+			length += sprintf(title + length, ", %.1f per draw (max %u), listed in %.2f ms",
+				gObjectLights.GetAverageLights(), gObjectLights.GetMaxLights(), gObjectLights.GetBuildTime());
+		length += sprintf(title + length, " | shadows: %s", ShadowCache::GetPathName(gShadowCache.GetPath()));
+		if (filter == SHADOW_FILTER_EVSM)
+			length += sprintf(title + length, ", evsm blur %u (%.2f ms per update), bleeding %.2f",
+				gShadowCache.GetFilterRadius(), gShadowCache.GetFilterTime(), lightBleeding);
+		else
+			length += sprintf(title + length, ", %d samples%s", shadowSamples, adaptiveShadows ? " (adaptive)" : "");
+		if (gShadowCache.IsTimeSliced())
+			length += sprintf(title + length, " | shadow faces %u drawn, %u waiting (budget %u)",
+				gShadowCache.GetRenderedCount(), gShadowCache.GetSkippedCount(), gShadowCache.GetFaceBudget());
+		else
+			length += sprintf(title + length, " | shadow maps %u drawn, %u cached",
+				gShadowCache.GetRenderedCount(), gShadowCache.GetSkippedCount());
+		if (lastReport[0] != 0 && SDL_GetTicks() - lastReportTicks < REPORT_MS)
+			snprintf(title + length, sizeof(title) - length, " | %s", lastReport);
+		SDL_SetWindowTitle(gWindow, title);
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	for (int i = 0;i < pointLightPositions.size();i++)
+	{
+		if (lightViews[i] >= 0)
+			gShadowCache.Update(i, lightViews[i], shadowViews[i]);
+	}
+	gShadowCache.SetViewer(camera.Position, glm::radians(camera.Zoom));
+	gShadowCache.Render(gQueue, far_plane);
 
 	glViewport(0, 0, 1200, 900);
 
@@ -615,43 +1144,81 @@ void render()
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 
-	glm::mat4 view = camera.GetViewMatrix();
-	glm::mat4 proj = glm::perspective(glm::radians(camera.Zoom), 4.0f / 3.0f, 0.1f, 100.0f);
-
-	glUseProgram(gShader.ID);
-	gShader.setMat4("view", view);
-	gShader.setMat4("proj", proj);
-	gShader.setVec3("viewPos", camera.Position);
+	//the unshadowed lights go to the clusters of the camera
+	gClusters.Assign(view, proj, 0.1f, far_plane);
+	gClusters.Bind();
+	gObjectLights.Bind();
 
-	//lighting
-	gShader.setVec3("lamp[0].position", pointLightPositions[0]);
-	gShader.setVec3("lamp[0].ambient", 0.2f, 0.2f, 0.2f);
-	gShader.setVec3("lamp[0].diffuse", lightdiff[0]);
-	gShader.setFloat("lamp[0].constant", 1.0f);
-	gShader.setFloat("lamp[0].linear", 0.14f);
-	gShader.setFloat("lamp[0].quadratic", 0.07f);
-	
+	SetLightingUniforms(gShader, view, proj, far_plane);
+	if (deferredShading)
+	{
+		SetLightingUniforms(gDeferredShader, view, proj, far_plane);
+		gDeferredShader.setMat4("inverseViewProj", glm::inverse(proj * view));
+		glUseProgram(gGBufferShader.ID);
+		gGBufferShader.setMat4("view", view);
+		gGBufferShader.setMat4("proj", proj);
+	}
 
-	gShader.setVec3("lamp[1].position", pointLightPositions[1]);
-	gShader.setVec3("lamp[1].ambient", 0.2f, 0.2f, 0.2f);
-	gShader.setVec3("lamp[1].diffuse", lightdiff[1]);
-	gShader.setFloat("lamp[1].constant", 1.0f);
-	gShader.setFloat("lamp[1].linear", 0.07f);
-	gShader.setFloat("lamp[1].quadratic", 0.017f);
+	for (unsigned int i = 0; i < MAP_LAMPS; i++)
+	{
+		glActiveTexture(GL_TEXTURE3 + i);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, gShadowCache.GetCubeMap(i));
+		glActiveTexture(GL_TEXTURE6 + i);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, gShadowCache.GetParaboloidMap(i));
+		glActiveTexture(GL_TEXTURE8 + i);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, gShadowCache.GetMomentMap(i));
+	}
+	for (unsigned int t = 0; gShadowCache.IsAtlasSupported() && t < ShadowAtlas::TIERS; t++)
+	{
+		glActiveTexture(GL_TEXTURE0 + SHADOW_ATLAS_TEXTURE_UNIT + t);
+		glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, gShadowCache.GetAtlasMap(t));
+	}
+	glActiveTexture(GL_TEXTURE0);
 
-	gShader.setFloat("ambientlight", ambientLight);
+	if (deferredShading)
+		gGBuffer.Begin();
 
-	gShader.setFloat("far_plane", far_plane);
-	gShader.setBool("shadowenable[0]", shadow1);
-	gShader.setBool("shadowenable[1]", shadow2);
+	//the pre-pass fills the depth buffer, the shading pass then only runs the fragments
+	//with exactly that depth and leaves the depth buffer as it is
+	if (depthPrePass)
+	{
+		gDepthTimer.Begin();
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glUseProgram(gDepthPrePassShader.ID);
+		gDepthPrePassShader.setMat4("view", view);
+		gDepthPrePassShader.setMat4("proj", proj);
+		glUseProgram(gDepthCutoutShader.ID);
+		gDepthCutoutShader.setMat4("view", view);
+		gDepthCutoutShader.setMat4("proj", proj);
+		gQueue.ExecuteDepth(gDepthPrePassShader, gDepthCutoutShader);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		gDepthTimer.End();
+
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+	}
 
+	GpuTimer& shadingTimer = lightBenchmarkFrame >= 0 ? gLightBenchmarkTimers[stressStep][lightAssignment] :
+		gShadingTimer[depthPrePass][gShadowCache.GetFilter()];
+	shadingTimer.Begin();
+	if (deferredShading)
+	{
+		//the surfaces first, then the lights once per covered pixel
+		gQueue.ExecuteOpaque(&gGBufferShader);
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
+		glUseProgram(gDeferredShader.ID);
+		gGBuffer.Light();
+	}
+	else
+		gQueue.ExecuteOpaque();
+	shadingTimer.End();
 
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, texIDDeapth[0]);
-	glActiveTexture(GL_TEXTURE4);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, texIDDeapth[1]);
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
 
-	gRoot->Traverse();
+	//test the boxes of the objects in view against the depth of this frame, read next frame
+	gOcclusion.IssueQueries(proj * view);
 
 	glUseProgram(gSkyBoxShader.ID);
 
@@ -662,33 +1229,15 @@ void render()
 
 	skybox->Draw();
 
-}
-
-//creates a deptbuffer and a cubemap texture
-bool loadDepthcubemap(GLuint& texID, GLuint& FBO)
-{
-
-	glGenFramebuffers(1, &FBO);
-
-	glGenTextures(1, &texID);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
-
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-	for (unsigned int i = 0; i < 6; ++i)
-		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-
-	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texID, 0);
-	glDrawBuffer(GL_NONE);
-	glReadBuffer(GL_NONE);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	//transparent surfaces last, back to front over the opaque scene and the sky,
+	//they are tested against the depth buffer but do not write to it
+	glEnable(GL_BLEND);
+	glDepthMask(GL_FALSE);
+	gQueue.ExecuteTransparent();
+	glDepthMask(GL_TRUE);
+	glDisable(GL_BLEND);
 
-	return true;
+	gQueue.EndFrame();
 }
 
 bool KelvintoRGB(glm::vec3& lightdiff, float temp) {
@@ -738,3 +1287,202 @@ bool KelvintoRGB(glm::vec3& lightdiff, float temp) {
 	return true;
 
 }
+
+//distance at which the attenuated light drops below 5/256 of its brightest channel,
+//nothing past it can receive noticeable light or cast a visible shadow
+float LightRange(const glm::vec3& attenuation, const glm::vec3& diffuse)
+{
+	float brightest = max(max(diffuse.x, diffuse.y), diffuse.z);
+	float constant = attenuation.x - brightest * 256.0f / 5.0f;
+	if (attenuation.z <= 0.0f)
+		return attenuation.y > 0.0f ? -constant / attenuation.y : 1000.0f;
+
+	return (-attenuation.y + sqrt(attenuation.y * attenuation.y - 4.0f * attenuation.z * constant)) / (2.0f * attenuation.z);
+}
+
+//count lights in rows under the ceiling and along the walls of the room, like the fixtures of a hallway.
+//the colors are spread over the warm to cold range of the lamps
+void CreateStressLights(unsigned int count)
+{
+	const glm::vec3 roomMin(-4.6f, 0.5f, -2.6f);
+	const glm::vec3 roomMax(4.2f, 4.6f, 6.8f);
+	const glm::vec3 attenuation(1.0f, 1.4f, 7.2f);
+
+	vector<ClusterLight> lights(count);
+	stressLightOrigins.resize(count);
+	//rows along z, as many per layer as fit the square root of the count
+	unsigned int rows = max((unsigned int)sqrt((float)count), 1u);
+	unsigned int perRow = (count + rows - 1) / rows;
+	for (unsigned int i = 0; i < count; i++)
+	{
+		glm::vec3 t(((i / perRow) + 0.5f) / rows, 0.0f, ((i % perRow) + 0.5f) / perRow);
+		//the heights cycle, so neighbouring fixtures are not all in one plane
+		t.y = 1.0f - (i % 4) / 3.0f;
+		stressLightOrigins[i] = roomMin + (roomMax - roomMin) * t;
+
+		glm::vec3 color;
+		KelvintoRGB(color, 2000.0f + 7000.0f * ((i * 37) % 101) / 100.0f);
+		lights[i].position = stressLightOrigins[i];
+		lights[i].diffuse = color * 0.5f;
+		lights[i].attenuation = attenuation;
+		lights[i].range = LightRange(attenuation, lights[i].diffuse);
+	}
+	gClusters.SetLights(lights);
+}
+
+void UpdateStressLights(float time)
+{
+	vector<ClusterLight>& lights = gClusters.GetLights();
+	for (unsigned int i = 0; i < lights.size(); i++)
+		lights[i].position = stressLightOrigins[i] + glm::vec3(0.0f, 0.2f * sin(time * 1.5f + i * 0.7f), 0.0f);
+}
+
+//every light count of the stress scene for LIGHT_BENCHMARK_FRAMES frames with each way of assigning
+//the lights, then reports the main pass times
+void BeginLightBenchmarkFrame()
+{
+	if (lightBenchmarkFrame < 0)
+		return;
+
+	//the assignment time of the previous frame belongs to the stage it was measured in
+	if (lightBenchmarkFrame > 0)
+	{
+		unsigned int previous = (lightBenchmarkFrame - 1) / LIGHT_BENCHMARK_FRAMES;
+		LightAssignment assignment = (LightAssignment)(previous % LIGHT_ASSIGNMENTS);
+		if (assignment != LIGHTS_ALL)
+			lightBenchmarkAssign[previous / LIGHT_ASSIGNMENTS][assignment] +=
+				assignment == LIGHTS_CLUSTERED ? gClusters.GetAssignTime() : gObjectLights.GetBuildTime();
+	}
+
+	unsigned int stage = lightBenchmarkFrame / LIGHT_BENCHMARK_FRAMES;
+	if (stage == STRESS_STEPS * LIGHT_ASSIGNMENTS)
+	{
+		Report("lighting benchmark, main pass (cpu light assignment):");
+		Report("  lights   clustered            per object           all per fragment");
+		for (unsigned int n = 0; n < STRESS_STEPS; n++)
+		{
+			Report("  %6u   %7.3f ms (%.3f ms)   %7.3f ms (%.3f ms)   %7.3f ms", STRESS_LIGHTS[n],
+				gLightBenchmarkTimers[n][LIGHTS_CLUSTERED].GetAverage(), lightBenchmarkAssign[n][LIGHTS_CLUSTERED] / LIGHT_BENCHMARK_FRAMES,
+				gLightBenchmarkTimers[n][LIGHTS_PER_OBJECT].GetAverage(), lightBenchmarkAssign[n][LIGHTS_PER_OBJECT] / LIGHT_BENCHMARK_FRAMES,
+				gLightBenchmarkTimers[n][LIGHTS_ALL].GetAverage());
+		}
+		lightBenchmarkFrame = -1;
+		stressStep = lightBenchmarkRestore;
+		lightAssignment = LIGHTS_CLUSTERED;
+		CreateStressLights(STRESS_LIGHTS[stressStep]);
+		return;
+	}
+
+	if (lightBenchmarkFrame % LIGHT_BENCHMARK_FRAMES == 0)
+	{
+		stressStep = stage / LIGHT_ASSIGNMENTS;
+		lightAssignment = (LightAssignment)(stage % LIGHT_ASSIGNMENTS);
+		lightBenchmarkAssign[stressStep][lightAssignment] = 0.0f;
+		CreateStressLights(STRESS_LIGHTS[stressStep]);
+	}
+	lightBenchmarkFrame++;
+}
+
+//points the shadow map and cluster samplers of a lighting shader (forward or deferred) at their units
+void SetLightingSamplers(Shader& shader)
+{
+	glUseProgram(shader.ID);
+	for (unsigned int i = 0; i < MAP_LAMPS; i++)
+	{
+		string index = "[" + std::to_string(i) + "]";
+		shader.setInt("depthMap" + index, 3 + i);
+		shader.setInt("paraboloidMap" + index, 6 + i);
+		shader.setInt("momentMap" + index, 8 + i);
+	}
+	for (unsigned int t = 0; t < ShadowAtlas::TIERS; t++)
+		shader.setInt("shadowAtlas[" + std::to_string(t) + "]", SHADOW_ATLAS_TEXTURE_UNIT + t);
+	shader.setInt("clusterLights", CLUSTER_LIGHTS_TEXTURE_UNIT);
+	shader.setInt("clusterGrid", CLUSTER_GRID_TEXTURE_UNIT);
+	shader.setInt("clusterIndices", CLUSTER_INDICES_TEXTURE_UNIT);
+	shader.setInt("objectLights", OBJECT_LIGHTS_TEXTURE_UNIT);
+	glUniform3i(glGetUniformLocation(shader.ID, "clusterDims"), LightClusters::CLUSTERS_X, LightClusters::CLUSTERS_Y, LightClusters::CLUSTERS_Z);
+	shader.setVec2("clusterTileSize", 1200.0f / LightClusters::CLUSTERS_X, 900.0f / LightClusters::CLUSTERS_Y);
+}
+
+//camera, lamps, shadow settings and clusters of the frame, for the forward and the deferred lighting
+void SetLightingUniforms(Shader& shader, const glm::mat4& view, const glm::mat4& proj, float far_plane)
+{
+	glUseProgram(shader.ID);
+	shader.setMat4("view", view);
+	shader.setMat4("proj", proj);
+	shader.setVec3("viewPos", camera.Position);
+
+	//lighting, the lamps past lampCount are not read. the atlas layout finds the cube of a lamp by its slot,
+	//the maps layout by its index
+	unsigned int lampCount = ShadowedLampCount();
+	shader.setInt("lampCount", lampCount);
+	for (unsigned int i = 0; i < lampCount; i++)
+	{
+		string lamp = "lamp[" + std::to_string(i) + "]";
+		string index = "[" + std::to_string(i) + "]";
+		shader.setVec3(lamp + ".position", pointLightPositions[i]);
+		shader.setVec3(lamp + ".ambient", 0.2f, 0.2f, 0.2f);
+		shader.setVec3(lamp + ".diffuse", lightdiff[i]);
+		shader.setFloat(lamp + ".constant", lightAttenuation[i].x);
+		shader.setFloat(lamp + ".linear", lightAttenuation[i].y);
+		shader.setFloat(lamp + ".quadratic", lightAttenuation[i].z);
+		shader.setBool("shadowenable" + index, lampOn[i]);
+		if (gShadowCache.IsAtlas())
+			glUniform2i(glGetUniformLocation(shader.ID, ("atlasSlot" + index).c_str()), gShadowCache.GetAtlasTier(i), gShadowCache.GetAtlasSlot(i));
+		else
+			shader.setBool("paraboloid" + index, gShadowCache.GetMapType(i) == SHADOW_PARABOLOID);
+	}
+
+	shader.setFloat("ambientlight", ambientLight);
+
+	shader.setFloat("far_plane", far_plane);
+	shader.setInt("shadowSamples", shadowSamples);
+	shader.setBool("adaptiveShadows", adaptiveShadows);
+	shader.setBool("momentShadows", gShadowCache.GetFilter() == SHADOW_FILTER_EVSM);
+	shader.setVec2("momentExponents", ShadowCache::GetMomentExponents());
+	shader.setFloat("lightBleeding", lightBleeding);
+	shader.setInt("clusterLightCount", gClusters.GetLightCount());
+	shader.setInt("lightAssignment", lightAssignment);
+	shader.setVec2("clusterSlices", gClusters.GetSliceScaleBias());
+}
+
+//points gShader and gDeferredShader at the lighting shaders of the shadow layout in use
+void SelectLightingShaders()
+{
+	gShader = gLayoutShaders[gShadowCache.IsAtlas() ? 1 : 0];
+	gDeferredShader = gDeferredLayoutShaders[gShadowCache.IsAtlas() ? 1 : 0];
+}
+
+//the atlas shadows every lamp, the maps layout only the lamps it has samplers for
+unsigned int ShadowedLampCount()
+{
+	return gShadowCache.IsAtlas() ? pointLightPositions.size() : min((unsigned int)pointLightPositions.size(), MAP_LAMPS);
+}
+
+//the times of the shadow cache benchmark (F11)
+void ReportShadowBenchmark()
+{
+	Report("shadow benchmark, all maps redrawn every frame:");
+	for (unsigned int p = 0; p < SHADOW_PATHS; p++)
+	{
+		if (gShadowCache.IsPathSupported((ShadowPath)p))
+			Report("  cube, %-20s %.3f ms, %.1f MB per light", ShadowCache::GetPathName((ShadowPath)p), gShadowCache.GetBenchmarkTime(p),
+				gShadowCache.MapMemory(SHADOW_CUBE) / (1024.0f * 1024.0f));
+		else
+			Report("  cube, %-20s not supported", ShadowCache::GetPathName((ShadowPath)p));
+	}
+	Report("  dual-paraboloid            %.3f ms, %.1f MB per light", gShadowCache.GetBenchmarkTime(SHADOW_PATHS),
+		gShadowCache.MapMemory(SHADOW_PARABOLOID) / (1024.0f * 1024.0f));
+}
+
+//the messages of the key toggles and the benchmarks are printed on the console,
+//the last one is also shown after the stats in the window title for a few seconds
+void Report(const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	vsnprintf(lastReport, sizeof(lastReport), format, args);
+	va_end(args);
+	lastReportTicks = SDL_GetTicks();
+	printf("%s\n", lastReport);
+}
@@ -9,7 +9,7 @@
 #include <vector>
 #include "Model.h"
 #include "BoundingObjects.h"
-#include "GroupNode.h"
+#include "SceneBVH.h"
 
 // Defines several possible options for camera movement. Used as abstraction to stay away from window-system specific input methods
 enum Camera_Movement {
@@ -74,7 +74,7 @@ public:
 	}
 
 	// Processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
-	void ProcessKeyboard(Camera_Movement direction, float deltaTime,GroupNode*& gRoot)
+	void ProcessKeyboard(Camera_Movement direction, float deltaTime, SceneBVH& sceneIndex)
 	{
 		float velocity = MovementSpeed * deltaTime;
 		
@@ -101,7 +101,7 @@ public:
 		VelVec *= length / glm::length(VelVec);*/
 
 		//find all collisions and calc the resulting velocity vector
-		gRoot->TraverseCollisions(*playerbox, VelVec, coll);
+		sceneIndex.Collisions(*playerbox, VelVec, coll);
 		if(coll.size()>0)
 		{
 			
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+//per draw data, read by the shaders from a buffer texture (7 RGBA32F texels per record)
+struct DrawRecord
+{
+	glm::mat4 model;
+	//columns of the normal matrix in xyz, the w of the first column holds the material index,
+	//the w of the second one the cube faces the draw casts shadows on (bit per face),
+	//the w of the third one the offset of the light list of the draw (ObjectLights)
+	glm::vec4 normalMat[3];
+};
+
+//layout of the commands read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+	unsigned int count;
+	unsigned int instanceCount;
+	unsigned int firstIndex;
+	int baseVertex;
+	//the first draw record of the command, picked up by the instanced draw index attribute
+	unsigned int baseInstance;
+};
+
+#define DRAW_RECORD_TEXELS 7
+//attribute location of the per instance draw index
+#define DRAW_ID_ATTRIB 5
+//texture unit of the samplerBuffer the records are read from
+#define DRAW_DATA_TEXTURE_UNIT 5
+
+//ring of per draw records split in three segments, one per frame in flight.
+//the buffer is persistently mapped when ARB_buffer_storage exists and fences keep the CPU from
+//overwriting a segment the GPU still reads from. otherwise the records are staged on the CPU,
+//the buffer is orphaned every frame and holds a single segment, so no fences are needed.
+//shaders get the record index from an instanced attribute that counts up from the first
+//record of the batch, so no uniforms are touched per draw
+class DrawDataBuffer
+{
+public:
+	static const unsigned int FRAMES = 3;
+
+private:
+	unsigned int buffer;
+	unsigned int texture;
+	//0, 1, 2 ... read with divisor 1 as the draw index
+	unsigned int drawIDs;
+	//records per segment
+	unsigned int capacity;
+	unsigned int segment;
+	unsigned int count;
+	unsigned int flushed;
+	//records that did not fit this frame, the next frame grows the ring by them
+	unsigned int dropped;
+	bool persistent;
+	DrawRecord* mapped;
+	vector<DrawRecord> staging;
+	GLsync fences[FRAMES];
+
+public:
+	DrawDataBuffer()
+	{
+		buffer = 0;
+		texture = 0;
+		drawIDs = 0;
+		capacity = 0;
+		segment = 0;
+		count = 0;
+		flushed = 0;
+		dropped = 0;
+		persistent = false;
+		mapped = NULL;
+		for (unsigned int i = 0; i < FRAMES; i++)
+			fences[i] = 0;
+	}
+
+	bool IsPersistent() const
+	{
+		return persistent;
+	}
+
+	//moves to the next segment and makes room for at least the given number of records.
+	//waits until the GPU is done with the frame that used the segment last
+	void BeginFrame(unsigned int records)
+	{
+		records += dropped;
+		if (records > capacity)
+			Create(max(records * 2, 256u));
+
+		if (persistent)
+		{
+			segment = (segment + 1) % FRAMES;
+			WaitFence(segment);
+		}
+		else
+		{
+			//the GPU may still read the records of the last frames, a new store is handed out instead of waiting
+			glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+			glBufferData(GL_TEXTURE_BUFFER, capacity * sizeof(DrawRecord), NULL, GL_STREAM_DRAW);
+			glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		}
+
+		count = 0;
+		flushed = 0;
+		dropped = 0;
+	}
+
+	//reserves up to n consecutive records and returns where to write them, n receives the number
+	//reserved and first the absolute index of the first record. the rest is counted as dropped
+	DrawRecord* Allocate(unsigned int& n, unsigned int& first)
+	{
+		unsigned int reserved = min(n, capacity - count);
+		dropped += n - reserved;
+		n = reserved;
+		if (n == 0)
+			return NULL;
+
+		first = segment * capacity + count;
+		count += n;
+		return persistent ? mapped + first : &staging[first - segment * capacity];
+	}
+
+	//records of the frame that did not fit, their draws were skipped
+	unsigned int GetDropped() const
+	{
+		return dropped;
+	}
+
+	//makes the records written so far visible to the GPU
+	void Flush()
+	{
+		if (persistent || flushed == count)
+			return;
+
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferSubData(GL_TEXTURE_BUFFER, (segment * capacity + flushed) * sizeof(DrawRecord),
+			(count - flushed) * sizeof(DrawRecord), &staging[flushed]);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		flushed = count;
+	}
+
+	//to be called after the last draw that reads the records of the frame
+	void EndFrame()
+	{
+		if (persistent)
+			fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	void Bind() const
+	{
+		glActiveTexture(GL_TEXTURE0 + DRAW_DATA_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	//enables the draw index attribute on the bound VAO and points it at the first record of a batch,
+	//divisor consecutive instances read the same record
+	void BindDrawID(unsigned int first, unsigned int divisor = 1) const
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, drawIDs);
+		glEnableVertexAttribArray(DRAW_ID_ATTRIB);
+		glVertexAttribDivisor(DRAW_ID_ATTRIB, divisor);
+		glVertexAttribIPointer(DRAW_ID_ATTRIB, 1, GL_UNSIGNED_INT, sizeof(unsigned int), (void*)(first * sizeof(unsigned int)));
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	//deletes the GL objects, must be called while the context is alive
+	void Release()
+	{
+		for (unsigned int i = 0; i < FRAMES; i++)
+			WaitFence(i);
+
+		if (buffer != 0)
+		{
+			if (persistent)
+			{
+				glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+				glUnmapBuffer(GL_TEXTURE_BUFFER);
+				glBindBuffer(GL_TEXTURE_BUFFER, 0);
+			}
+			glDeleteBuffers(1, &buffer);
+			glDeleteBuffers(1, &drawIDs);
+			glDeleteTextures(1, &texture);
+		}
+		buffer = 0;
+		drawIDs = 0;
+		texture = 0;
+		mapped = NULL;
+	}
+
+private:
+	void WaitFence(unsigned int i)
+	{
+		if (fences[i] == 0)
+			return;
+
+		GLenum result = glClientWaitSync(fences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		while (result == GL_TIMEOUT_EXPIRED)
+			result = glClientWaitSync(fences[i], 0, 1000000);
+
+		glDeleteSync(fences[i]);
+		fences[i] = 0;
+	}
+
+	void Create(unsigned int records)
+	{
+		Release();
+		capacity = records;
+		segment = 0;
+
+		persistent = GLEW_ARB_buffer_storage || GLEW_VERSION_4_4;
+		GLsizeiptr size = (persistent ? FRAMES : 1) * capacity * sizeof(DrawRecord);
+
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		if (persistent)
+		{
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			glBufferStorage(GL_TEXTURE_BUFFER, size, NULL, flags);
+			mapped = (DrawRecord*)glMapBufferRange(GL_TEXTURE_BUFFER, 0, size, flags);
+			staging.clear();
+		}
+		else
+		{
+			glBufferData(GL_TEXTURE_BUFFER, size, NULL, GL_STREAM_DRAW);
+			staging.resize(capacity);
+		}
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+		vector<unsigned int> ids(size / sizeof(DrawRecord));
+		for (unsigned int i = 0; i < ids.size(); i++)
+			ids[i] = i;
+		glGenBuffers(1, &drawIDs);
+		glBindBuffer(GL_ARRAY_BUFFER, drawIDs);
+		glBufferData(GL_ARRAY_BUFFER, ids.size() * sizeof(unsigned int), &ids[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+};
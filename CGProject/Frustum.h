@@ -0,0 +1,194 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <xmmintrin.h>
+
+#include <vector>
+#include <cmath>
+using namespace std;
+
+//world space boxes in structure of arrays layout (center and half extent per axis),
+//so that four of them go through a plane test at once.
+//the arrays always hold a multiple of 4 entries, the padding is an empty box at the origin
+struct BoundsSoA
+{
+	vector<float> centerX, centerY, centerZ;
+	vector<float> extentX, extentY, extentZ;
+	unsigned int count;
+
+	BoundsSoA()
+	{
+		count = 0;
+	}
+
+	void Clear()
+	{
+		centerX.clear();
+		centerY.clear();
+		centerZ.clear();
+		extentX.clear();
+		extentY.clear();
+		extentZ.clear();
+		count = 0;
+	}
+
+	void Add(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+	{
+		if (count % 4 == 0)
+		{
+			centerX.resize(count + 4, 0.0f);
+			centerY.resize(count + 4, 0.0f);
+			centerZ.resize(count + 4, 0.0f);
+			extentX.resize(count + 4, 0.0f);
+			extentY.resize(count + 4, 0.0f);
+			extentZ.resize(count + 4, 0.0f);
+		}
+		glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+		centerX[count] = center.x;
+		centerY[count] = center.y;
+		centerZ[count] = center.z;
+		extentX[count] = extent.x;
+		extentY[count] = extent.y;
+		extentZ[count] = extent.z;
+		count++;
+	}
+};
+
+//the six planes of a view projection matrix, normals point inside.
+//frustums narrowed through portals have one plane per portal edge on top of the near and far planes
+class Frustum
+{
+public:
+	static const int MAX_PLANES = 16;
+
+private:
+	//plane p is nx[p] * x + ny[p] * y + nz[p] * z + d[p] = 0
+	float nx[MAX_PLANES], ny[MAX_PLANES], nz[MAX_PLANES], d[MAX_PLANES];
+	int planeCount;
+
+public:
+	Frustum()
+	{
+		Set(glm::mat4(1.0f));
+	}
+
+	Frustum(const glm::mat4& viewProj)
+	{
+		Set(viewProj);
+	}
+
+	//extracts the planes from the rows of the matrix (Gribb, Hartmann)
+	void Set(const glm::mat4& m)
+	{
+		glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		glm::vec4 planes[6];
+		planes[0] = row3 + row0; //left
+		planes[1] = row3 - row0; //right
+		planes[2] = row3 + row1; //bottom
+		planes[3] = row3 - row1; //top
+		planes[4] = row3 + row2; //near
+		planes[5] = row3 - row2; //far
+
+		planeCount = 0;
+		for (int p = 0; p < 6; p++)
+		{
+			float length = glm::length(glm::vec3(planes[p]));
+			AddPlane(glm::vec3(planes[p]) / length, planes[p].w / length);
+		}
+	}
+
+	void ClearPlanes()
+	{
+		planeCount = 0;
+	}
+
+	//normal must be unit length and point inside, ignored once MAX_PLANES are set
+	void AddPlane(const glm::vec3& normal, float distance)
+	{
+		if (planeCount == MAX_PLANES)
+			return;
+		nx[planeCount] = normal.x;
+		ny[planeCount] = normal.y;
+		nz[planeCount] = normal.z;
+		d[planeCount] = distance;
+		planeCount++;
+	}
+
+	int GetPlaneCount() const
+	{
+		return planeCount;
+	}
+
+	//xyz is the normal, w the distance
+	glm::vec4 GetPlane(int p) const
+	{
+		return glm::vec4(nx[p], ny[p], nz[p], d[p]);
+	}
+
+	//false when the box is completely outside one of the planes
+	bool IsBoxVisible(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const
+	{
+		glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+		for (int p = 0; p < planeCount; p++)
+		{
+			float distance = nx[p] * center.x + ny[p] * center.y + nz[p] * center.z + d[p];
+			float radius = fabs(nx[p]) * extent.x + fabs(ny[p]) * extent.y + fabs(nz[p]) * extent.z;
+			if (distance + radius < 0.0f)
+				return false;
+		}
+		return true;
+	}
+
+	bool IsSphereVisible(const glm::vec3& center, float radius) const
+	{
+		for (int p = 0; p < planeCount; p++)
+		{
+			if (nx[p] * center.x + ny[p] * center.y + nz[p] * center.z + d[p] < -radius)
+				return false;
+		}
+		return true;
+	}
+
+	//tests all boxes four at a time, visible[i] gets 1 when box i intersects the frustum.
+	//returns the number of visible boxes
+	unsigned int CullBoxes(const BoundsSoA& bounds, unsigned char* visible) const
+	{
+		const __m128 zero = _mm_setzero_ps();
+		unsigned int visibleCount = 0;
+
+		for (unsigned int i = 0; i < bounds.count; i += 4)
+		{
+			__m128 cx = _mm_loadu_ps(&bounds.centerX[i]);
+			__m128 cy = _mm_loadu_ps(&bounds.centerY[i]);
+			__m128 cz = _mm_loadu_ps(&bounds.centerZ[i]);
+			__m128 ex = _mm_loadu_ps(&bounds.extentX[i]);
+			__m128 ey = _mm_loadu_ps(&bounds.extentY[i]);
+			__m128 ez = _mm_loadu_ps(&bounds.extentZ[i]);
+			__m128 outside = zero;
+
+			for (int p = 0; p < planeCount; p++)
+			{
+				__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(nx[p])), _mm_mul_ps(cy, _mm_set1_ps(ny[p]))),
+					_mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(nz[p])), _mm_set1_ps(d[p])));
+				//projection of the half extent on the plane normal
+				__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(fabs(nx[p]))), _mm_mul_ps(ey, _mm_set1_ps(fabs(ny[p])))),
+					_mm_mul_ps(ez, _mm_set1_ps(fabs(nz[p]))));
+				outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+			}
+
+			int mask = _mm_movemask_ps(outside);
+			for (unsigned int k = 0; k < 4 && i + k < bounds.count; k++)
+			{
+				visible[i + k] = (mask & (1 << k)) ? 0 : 1;
+				visibleCount += visible[i + k];
+			}
+		}
+		return visibleCount;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#include <cstdio>
+
+//first texture unit of the G-buffer targets in the lighting pass: albedo, normal, specular, depth
+#define GBUFFER_TEXTURE_UNIT 13
+
+//render targets of the deferred path. the opaque draws write their albedo, world normal, specular
+//color (shininess / 256 in alpha) and depth, then one full-screen pass lights every pixel once,
+//however many surfaces were drawn over it
+class GBuffer
+{
+	enum Targets
+	{
+		ALBEDO,
+		NORMAL,
+		SPECULAR,
+		DEPTH,
+		TARGET_COUNT
+	};
+
+	unsigned int FBO;
+	unsigned int textures[TARGET_COUNT];
+	//empty VAO for the full-screen triangle, the vertices come from gl_VertexID
+	unsigned int VAO;
+
+public:
+	GBuffer()
+	{
+		FBO = VAO = 0;
+		for (unsigned int t = 0; t < TARGET_COUNT; t++)
+			textures[t] = 0;
+	}
+
+	bool Init(unsigned int width, unsigned int height)
+	{
+		static const GLenum formats[TARGET_COUNT] = { GL_RGBA8, GL_RGBA16F, GL_RGBA8, GL_DEPTH_COMPONENT24 };
+
+		glGenFramebuffers(1, &FBO);
+		glGenTextures(TARGET_COUNT, textures);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		for (unsigned int t = 0; t < TARGET_COUNT; t++)
+		{
+			glBindTexture(GL_TEXTURE_2D, textures[t]);
+			if (t == DEPTH)
+				glTexImage2D(GL_TEXTURE_2D, 0, formats[t], width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+			else
+				glTexImage2D(GL_TEXTURE_2D, 0, formats[t], width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+			//read one texel per pixel
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, t == DEPTH ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0 + t,
+				GL_TEXTURE_2D, textures[t], 0);
+		}
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		GLenum drawBuffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+		glDrawBuffers(3, drawBuffers);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (!complete)
+			printf("G-buffer incomplete\n");
+
+		glGenVertexArrays(1, &VAO);
+		return complete;
+	}
+
+	//binds and clears the targets for the opaque draws
+	void Begin() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	}
+
+	//back to the default framebuffer, then lights every covered pixel with the bound lighting shader.
+	//the pass writes the depth of the G-buffer, so the sky and the transparent draws that follow
+	//are tested against the opaque surfaces
+	void Light() const
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		for (unsigned int t = 0; t < TARGET_COUNT; t++)
+		{
+			glActiveTexture(GL_TEXTURE0 + GBUFFER_TEXTURE_UNIT + t);
+			glBindTexture(GL_TEXTURE_2D, textures[t]);
+		}
+		glActiveTexture(GL_TEXTURE0);
+
+		glDepthFunc(GL_ALWAYS);
+		glBindVertexArray(VAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		glBindVertexArray(0);
+		glDepthFunc(GL_LESS);
+	}
+
+	//deletes the GL objects, must be called while the context is alive
+	void Release()
+	{
+		if (FBO != 0)
+		{
+			glDeleteFramebuffers(1, &FBO);
+			glDeleteTextures(TARGET_COUNT, textures);
+			glDeleteVertexArrays(1, &VAO);
+		}
+		FBO = VAO = 0;
+		for (unsigned int t = 0; t < TARGET_COUNT; t++)
+			textures[t] = 0;
+	}
+};
@@ -0,0 +1,201 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstddef>
+using namespace std;
+
+//the vertex layout shared by all meshes in the arena
+struct Vertex {
+	// position
+	glm::vec3 Position;
+	// normal
+	glm::vec3 Normal;
+	// texCoords
+	glm::vec2 TexCoords;
+	// tangent
+	glm::vec3 Tangent;
+	// bitangent
+	glm::vec3 Bitangent;
+};
+
+//the part of a vertex read by the shading pass. tangent and bitangent stay on the CPU,
+//no shader variant reads them (vertex.vert only uses position, normal and texture coordinates)
+struct VertexAttributes {
+	glm::vec3 Normal;
+	glm::vec2 TexCoords;
+};
+
+//where a mesh was placed inside the arena
+struct ArenaAllocation
+{
+	//VAO of the block that holds the mesh, reads both vertex streams
+	unsigned int VAO;
+	//VAO of the same block that reads positions only, for the depth only passes
+	unsigned int depthVAO;
+	unsigned int block;
+	//added to every index of the mesh (glDrawElementsBaseVertex)
+	unsigned int baseVertex;
+	unsigned int firstIndex;
+	//unique per allocation, identifies the mesh when sorting draws
+	unsigned int id;
+};
+
+//suballocates the vertices and indices of all meshes into a few large buffers,
+//so that draws of different meshes don't need a VAO switch and whole blocks
+//can be drawn with one glMultiDrawElementsIndirect call.
+//vertices are split in a position stream and an attribute stream, so the shadow
+//passes fetch 12 bytes per vertex instead of the whole interleaved vertex
+class GeometryArena
+{
+	struct Block
+	{
+		unsigned int VAO, depthVAO;
+		unsigned int positionVBO, attributeVBO, EBO;
+		unsigned int vertexCount, vertexCapacity;
+		unsigned int indexCount, indexCapacity;
+	};
+
+	vector<Block> blocks;
+	unsigned int allocations;
+
+	GeometryArena()
+	{
+		allocations = 0;
+	}
+
+public:
+	//default block size, meshes bigger than that get a block of their own
+	static const unsigned int BLOCK_VERTICES = 1 << 20;
+	static const unsigned int BLOCK_INDICES = 3 << 20;
+
+	static GeometryArena& Get()
+	{
+		static GeometryArena arena;
+		return arena;
+	}
+
+	unsigned int GetBlockCount() const
+	{
+		return blocks.size();
+	}
+
+	//a mesh without vertices or faces takes no room, its VAOs stay 0 and it is never drawn
+	ArenaAllocation Allocate(const vector<Vertex>& vertices, const vector<unsigned int>& indices)
+	{
+		if (vertices.empty() || indices.empty())
+		{
+			ArenaAllocation empty = {};
+			empty.id = allocations++;
+			return empty;
+		}
+
+		unsigned int b = FindBlock(vertices.size(), indices.size());
+		Block& block = blocks[b];
+
+		ArenaAllocation allocation;
+		allocation.VAO = block.VAO;
+		allocation.depthVAO = block.depthVAO;
+		allocation.block = b;
+		allocation.baseVertex = block.vertexCount;
+		allocation.firstIndex = block.indexCount;
+		allocation.id = allocations++;
+
+		vector<glm::vec3> positions(vertices.size());
+		vector<VertexAttributes> attributes(vertices.size());
+		for (unsigned int i = 0; i < vertices.size(); i++)
+		{
+			positions[i] = vertices[i].Position;
+			attributes[i].Normal = vertices[i].Normal;
+			attributes[i].TexCoords = vertices[i].TexCoords;
+		}
+
+		glBindVertexArray(block.VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, block.positionVBO);
+		glBufferSubData(GL_ARRAY_BUFFER, block.vertexCount * sizeof(glm::vec3), positions.size() * sizeof(glm::vec3), &positions[0]);
+		glBindBuffer(GL_ARRAY_BUFFER, block.attributeVBO);
+		glBufferSubData(GL_ARRAY_BUFFER, block.vertexCount * sizeof(VertexAttributes), attributes.size() * sizeof(VertexAttributes), &attributes[0]);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, block.indexCount * sizeof(unsigned int), indices.size() * sizeof(unsigned int), &indices[0]);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		block.vertexCount += vertices.size();
+		block.indexCount += indices.size();
+
+		return allocation;
+	}
+
+	//deletes the GL objects, must be called while the context is alive
+	void Release()
+	{
+		for (unsigned int i = 0; i < blocks.size(); i++)
+		{
+			glDeleteVertexArrays(1, &blocks[i].VAO);
+			glDeleteVertexArrays(1, &blocks[i].depthVAO);
+			glDeleteBuffers(1, &blocks[i].positionVBO);
+			glDeleteBuffers(1, &blocks[i].attributeVBO);
+			glDeleteBuffers(1, &blocks[i].EBO);
+		}
+		blocks.clear();
+	}
+
+private:
+	//returns a block with enough room left, creating one if needed
+	unsigned int FindBlock(unsigned int vertexCount, unsigned int indexCount)
+	{
+		for (unsigned int i = 0; i < blocks.size(); i++)
+		{
+			if (blocks[i].vertexCount + vertexCount <= blocks[i].vertexCapacity &&
+				blocks[i].indexCount + indexCount <= blocks[i].indexCapacity)
+				return i;
+		}
+
+		Block block;
+		block.vertexCount = 0;
+		block.indexCount = 0;
+		block.vertexCapacity = vertexCount > BLOCK_VERTICES ? vertexCount : BLOCK_VERTICES;
+		block.indexCapacity = indexCount > BLOCK_INDICES ? indexCount : BLOCK_INDICES;
+
+		glGenVertexArrays(1, &block.VAO);
+		glGenVertexArrays(1, &block.depthVAO);
+		glGenBuffers(1, &block.positionVBO);
+		glGenBuffers(1, &block.attributeVBO);
+		glGenBuffers(1, &block.EBO);
+
+		glBindBuffer(GL_ARRAY_BUFFER, block.positionVBO);
+		glBufferData(GL_ARRAY_BUFFER, block.vertexCapacity * sizeof(glm::vec3), NULL, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, block.attributeVBO);
+		glBufferData(GL_ARRAY_BUFFER, block.vertexCapacity * sizeof(VertexAttributes), NULL, GL_STATIC_DRAW);
+
+		// the shading VAO reads both streams
+		glBindVertexArray(block.VAO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, block.EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, block.indexCapacity * sizeof(unsigned int), NULL, GL_STATIC_DRAW);
+		// vertex Positions
+		glBindBuffer(GL_ARRAY_BUFFER, block.positionVBO);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+		// vertex normals
+		glBindBuffer(GL_ARRAY_BUFFER, block.attributeVBO);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexAttributes), (void*)offsetof(VertexAttributes, Normal));
+		// vertex texture coords
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(VertexAttributes), (void*)offsetof(VertexAttributes, TexCoords));
+
+		// the depth only VAO reads positions only
+		glBindVertexArray(block.depthVAO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, block.EBO);
+		glBindBuffer(GL_ARRAY_BUFFER, block.positionVBO);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		blocks.push_back(block);
+		return blocks.size() - 1;
+	}
+};
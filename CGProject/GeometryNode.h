@@ -1,9 +1,9 @@
 #pragma once
 
 #include "Node.h"
-#include "TransformNode.h"
 #include "Model.h"
 #include "BoundingObjects.h"
+#include "RenderQueue.h"
 #include <glm\gtc\matrix_transform.hpp>
 
 class GeometryNode : public Node
@@ -13,6 +13,8 @@ class GeometryNode : public Node
 	Shader* ShadowShader;
 	BoundingSphere* boundingSphere = NULL;
 	BoundingBox* boundingBox = NULL;
+	//large closed surfaces (walls, floors) rasterized by the software occlusion culling
+	bool occluder = false;
 
 public:
 	GeometryNode() :  Node()
@@ -49,6 +51,14 @@ public:
 		boundingBox = new BoundingBox(this, model);
 	}
 
+	//the box of the model in model space, empty before a model is loaded
+	Bounds GetBounds() const
+	{
+		if (boundingBox == NULL)
+			return Bounds();
+		return Bounds(boundingBox->getFirstMin(), boundingBox->getFirstMax());
+	}
+
 	const Model& GetModel() const
 	{
 		return model;
@@ -64,61 +74,56 @@ public:
 		ShadowShader = sh;
 	}
 
-	const BoundingSphere& GetBoundingSphere()
+	void SetOccluder(bool isOccluder)
 	{
-		return *boundingSphere;
+		occluder = isOccluder;
 	}
 
-	BoundingBox& GetBoundingBox()
+	bool IsOccluder() const
 	{
-		return *boundingBox;
+		return occluder;
 	}
 
-	void Traverse()
+	const BoundingSphere& GetBoundingSphere()
 	{
-		glm::mat4 transform = TransformNode::GetTransformMatrix();
-		shader->setMat4("model", transform);
-		glm::mat3 normalMat = glm::transpose(glm::inverse(transform));
-		shader->setMat3("normalMat", normalMat);
-		boundingSphere->Transform(transform);
-		boundingBox->Transform(transform);
-		//printf("\n(%f, %f, %f)", boundingBox->getMin().x, boundingBox->getMin().y, boundingBox->getMin().z);
-		model.Draw(*shader);
+		return *boundingSphere;
 	}
 
-	void TraverseShadows()
+	BoundingBox& GetBoundingBox()
 	{
-		glm::mat4 transform = TransformNode::GetTransformMatrix();
-		ShadowShader->setMat4("model", transform);
-		model.Draw(*ShadowShader);
+		return *boundingBox;
 	}
 
-	virtual void TraverseIntersection(const glm::vec3& rayOrigin, const glm::vec3& rayDirection,
-		vector<Intersection*>& hits, vector<Node*>& path)
+	//records the meshes with the given world transform, world is the transformed model box
+	//and object the scene object the meshes belong to
+	//dynamic instances moved recently, the shadow maps keep them apart from the static casters.
+	//speed is the distance the instance moved this frame
+	void Submit(RenderQueue& queue, const glm::mat4& transform, const Bounds& world, unsigned int object = ~0u,
+		bool dynamic = false, float speed = 0.0f)
 	{
-		glm::mat4 transform = TransformNode::GetTransformMatrix();
-		boundingSphere->Transform(transform);
-		Intersection* hit = new Intersection();
-		if (boundingSphere->CollidesWithRay(rayOrigin, rayDirection, *hit))
+		for (unsigned int i = 0; i < model.meshes.size(); i++)
 		{
-			hit->path = path;
-			hits.push_back(hit);
+			queue.Submit(shader, ShadowShader, model.meshes[i], transform, world.lowest, world.highest, object, dynamic, speed);
 		}
 	}
 
-	virtual void TraverseCollisions(BoundingBox& player, const glm::vec3& velocity, vector<collision*>& collisions)
+	//ray test of the bounding sphere placed with the given world transform
+	bool Intersects(const glm::mat4& transform, const glm::vec3& rayOrigin, const glm::vec3& rayDirection, Intersection& hit)
+	{
+		boundingSphere->Transform(transform);
+		return boundingSphere->CollidesWithRay(rayOrigin, rayDirection, hit);
+	}
+
+	//swept player test of the bounding box placed with the given world transform
+	void Collides(const glm::mat4& transform, BoundingBox& player, const glm::vec3& velocity, vector<collision*>& collisions)
 	{
-		glm::mat4 transform = TransformNode::GetTransformMatrix();
 		boundingBox->Transform(transform);
-		
-		
-		if(player.BroadCheck(*boundingBox,velocity))
+		if (player.BroadCheck(*boundingBox, velocity))
 		{
 			collision* coll = new collision();
 			coll->entrytime = player.PlayerCollidesWithAABBSwept(*boundingBox, coll->normal, velocity);
 			collisions.push_back(coll);
-			
 		}
-
 	}
-};
+
+};
\ No newline at end of file
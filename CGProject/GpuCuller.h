@@ -0,0 +1,184 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "Frustum.h"
+#include "DrawDataBuffer.h"
+
+#include <vector>
+using namespace std;
+
+//world bounds of one draw record of the main pass, same layout as CullObject in cull.comp
+struct CullObject
+{
+	glm::vec3 center;
+	//command the record is an instance of
+	unsigned int command;
+	glm::vec3 extent;
+	unsigned int padding;
+};
+
+//the run of a command and the first command of that run, same layout as CommandRun in cull.comp
+struct CommandRun
+{
+	unsigned int run;
+	unsigned int firstCommand;
+};
+
+//frustum culling of the main pass on the GPU (GL 4.3). the bounds of every record go into a
+//storage buffer, a compute shader tests them and appends the visible records to the instance
+//list of their command, the draw index attribute then reads the record from that list.
+//with ARB_indirect_parameters a second dispatch also moves the non empty commands to the
+//front of their run and the run is drawn with its GPU written draw count.
+//the CPU only uploads the data, its cost does not depend on how much is visible
+class GpuCuller
+{
+	static const unsigned int GROUP_SIZE = 64;
+
+	Shader* shader;
+	unsigned int objectBuffer;
+	unsigned int commandBuffer;
+	unsigned int drawIDBuffer;
+	unsigned int runBuffer;
+	unsigned int runCountBuffer;
+	unsigned int compactedBuffer;
+	bool compaction;
+
+public:
+	GpuCuller()
+	{
+		shader = NULL;
+		objectBuffer = commandBuffer = drawIDBuffer = 0;
+		runBuffer = runCountBuffer = compactedBuffer = 0;
+		compaction = false;
+	}
+
+	void Init(Shader* cullShader)
+	{
+		shader = cullShader;
+		compaction = GLEW_ARB_indirect_parameters != 0;
+
+		glGenBuffers(1, &objectBuffer);
+		glGenBuffers(1, &commandBuffer);
+		glGenBuffers(1, &drawIDBuffer);
+		glGenBuffers(1, &runBuffer);
+		glGenBuffers(1, &runCountBuffer);
+		glGenBuffers(1, &compactedBuffer);
+	}
+
+	bool IsReady() const
+	{
+		return shader != NULL;
+	}
+
+	bool IsCompacting() const
+	{
+		return compaction;
+	}
+
+	//uploads the records and commands of the main pass and culls them, the commands come with
+	//their instance counts at 0 and baseInstance set to the first draw id slot of the command.
+	//frustum is NULL when culling is off
+	void Cull(const Frustum* frustum, const vector<CullObject>& objects, unsigned int firstRecord,
+		const vector<DrawElementsIndirectCommand>& commands, const vector<CommandRun>& runs, unsigned int runCount)
+	{
+		if (objects.empty())
+			return;
+
+		//orphan the storage of the previous frame, it may still be read by its draws
+		Upload(objectBuffer, objects.size() * sizeof(CullObject), &objects[0]);
+		Upload(commandBuffer, commands.size() * sizeof(DrawElementsIndirectCommand), &commands[0]);
+		Upload(drawIDBuffer, objects.size() * sizeof(unsigned int), NULL);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, objectBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, drawIDBuffer);
+
+		glUseProgram(shader->ID);
+		shader->setInt("stage", 0);
+		shader->setInt("count", objects.size());
+		shader->setInt("firstRecord", firstRecord);
+		glm::vec4 planes[6];
+		int planeCount = frustum == NULL ? 0 : min(frustum->GetPlaneCount(), 6);
+		for (int p = 0; p < planeCount; p++)
+			planes[p] = frustum->GetPlane(p);
+		shader->setInt("planeCount", planeCount);
+		glUniform4fv(glGetUniformLocation(shader->ID, "planes"), 6, &planes[0][0]);
+		glDispatchCompute((objects.size() + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+
+		if (compaction)
+		{
+			vector<unsigned int> zeros(runCount, 0);
+			Upload(runBuffer, runs.size() * sizeof(CommandRun), &runs[0]);
+			Upload(runCountBuffer, zeros.size() * sizeof(unsigned int), &zeros[0]);
+			Upload(compactedBuffer, commands.size() * sizeof(DrawElementsIndirectCommand), NULL);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, runBuffer);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, runCountBuffer);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, compactedBuffer);
+
+			//the instance counts of the first dispatch must be complete
+			glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+			shader->setInt("stage", 1);
+			shader->setInt("count", commands.size());
+			glDispatchCompute((commands.size() + GROUP_SIZE - 1) / GROUP_SIZE, 1, 1);
+		}
+
+		glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+		for (unsigned int b = 0; b < 6; b++)
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, 0);
+	}
+
+	//draws the commands of run on the bound VAO, the draw index attribute reads the culled instance lists.
+	//keepOrder draws from the uncompacted commands, in the order they were sorted
+	void Draw(unsigned int run, unsigned int firstCommand, unsigned int commandCount, bool keepOrder)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, drawIDBuffer);
+		glEnableVertexAttribArray(DRAW_ID_ATTRIB);
+		glVertexAttribDivisor(DRAW_ID_ATTRIB, 1);
+		glVertexAttribIPointer(DRAW_ID_ATTRIB, 1, GL_UNSIGNED_INT, sizeof(unsigned int), (void*)0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		void* offset = (void*)(firstCommand * sizeof(DrawElementsIndirectCommand));
+		if (compaction && !keepOrder)
+		{
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, compactedBuffer);
+			glBindBuffer(GL_PARAMETER_BUFFER_ARB, runCountBuffer);
+			glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, offset,
+				run * sizeof(unsigned int), commandCount, 0);
+			glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+		}
+		else
+		{
+			//commands without visible instances stay in the buffer and draw nothing
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, offset, commandCount, 0);
+		}
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	//deletes the GL objects, must be called while the context is alive
+	void Release()
+	{
+		if (objectBuffer != 0)
+		{
+			glDeleteBuffers(1, &objectBuffer);
+			glDeleteBuffers(1, &commandBuffer);
+			glDeleteBuffers(1, &drawIDBuffer);
+			glDeleteBuffers(1, &runBuffer);
+			glDeleteBuffers(1, &runCountBuffer);
+			glDeleteBuffers(1, &compactedBuffer);
+		}
+		objectBuffer = commandBuffer = drawIDBuffer = 0;
+		runBuffer = runCountBuffer = compactedBuffer = 0;
+		shader = NULL;
+	}
+
+private:
+	static void Upload(unsigned int buffer, size_t size, const void* data)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_STREAM_DRAW);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	}
+};
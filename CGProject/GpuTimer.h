@@ -0,0 +1,101 @@
+#pragma once
+
+#include <GL/glew.h>
+
+//measures the GPU time of a range of commands with GL_TIME_ELAPSED queries (GL 3.3).
+//a ring of queries is kept so the result of an older frame is read once it is available,
+//the CPU never waits for it
+class GpuTimer
+{
+	static const unsigned int FRAMES = 4;
+
+	unsigned int queries[FRAMES];
+	bool pending[FRAMES];
+	unsigned int current;
+	bool running;
+	//last result and its running average
+	float milliseconds;
+	float average;
+
+public:
+	GpuTimer()
+	{
+		for (unsigned int i = 0; i < FRAMES; i++)
+		{
+			queries[i] = 0;
+			pending[i] = false;
+		}
+		current = 0;
+		running = false;
+		milliseconds = average = 0.0f;
+	}
+
+	//only one timer can run at a time (GL_TIME_ELAPSED queries do not nest)
+	void Begin()
+	{
+		if (queries[0] == 0)
+			glGenQueries(FRAMES, queries);
+
+		Collect();
+		current = (current + 1) % FRAMES;
+		//still in flight after FRAMES frames, drop this measurement
+		if (pending[current])
+			return;
+
+		glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+		running = true;
+	}
+
+	void End()
+	{
+		if (!running)
+			return;
+		glEndQuery(GL_TIME_ELAPSED);
+		pending[current] = true;
+		running = false;
+	}
+
+	float GetMilliseconds() const
+	{
+		return milliseconds;
+	}
+
+	float GetAverage() const
+	{
+		return average;
+	}
+
+	void Release()
+	{
+		if (queries[0] != 0)
+			glDeleteQueries(FRAMES, queries);
+		for (unsigned int i = 0; i < FRAMES; i++)
+		{
+			queries[i] = 0;
+			pending[i] = false;
+		}
+	}
+
+private:
+	//reads the results that have arrived, oldest first
+	void Collect()
+	{
+		for (unsigned int k = 1; k <= FRAMES; k++)
+		{
+			unsigned int i = (current + k) % FRAMES;
+			if (!pending[i])
+				continue;
+
+			GLuint available = 0;
+			glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				continue;
+
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsed);
+			pending[i] = false;
+			milliseconds = elapsed / 1000000.0f;
+			average = average == 0.0f ? milliseconds : average * 0.95f + milliseconds * 0.05f;
+		}
+	}
+};
@@ -33,37 +33,4 @@ public:
 		return children[ix];
 	}
 
-	virtual void Traverse()
-	{
-		for (unsigned int i = 0; i < children.size(); i++)
-		{
-			children[i]->Traverse();
-		}
-	}
-
-	virtual void TraverseShadows()
-	{
-		for (unsigned int i = 0; i < children.size(); i++)
-		{
-			children[i]->TraverseShadows();
-		}
-	}
-
-	virtual void TraverseIntersection(const glm::vec3& rayOrigin, const glm::vec3& rayDirection,
-		vector<Intersection*>& hits, vector<Node*>& path)
-	{
-		path.push_back(this);
-		for (unsigned int i = 0; i < children.size(); i++)
-		{
-			children[i]->TraverseIntersection(rayOrigin, rayDirection, hits, path);
-		}
-		path.pop_back();
-	}
-
-	virtual void TraverseCollisions(BoundingBox& player, const glm::vec3& velocity, vector<collision*>& collisions)
-	{
-		for (unsigned int i = 0; i < children.size(); i++) {
-			children[i]->TraverseCollisions(player, velocity, collisions);
-		}
-	}
 };
@@ -0,0 +1,311 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+using namespace std;
+
+//unshadowed point light of the clustered pass
+struct ClusterLight
+{
+	glm::vec3 position;
+	//distance past which the light is ignored
+	float range;
+	glm::vec3 diffuse;
+	//constant, linear and quadratic attenuation
+	glm::vec3 attenuation;
+};
+
+//texture units of the light data, the cluster grid and the light indices
+#define CLUSTER_LIGHTS_TEXTURE_UNIT 10
+#define CLUSTER_GRID_TEXTURE_UNIT 11
+#define CLUSTER_INDICES_TEXTURE_UNIT 12
+
+//texels of a light in the light buffer: position and range, diffuse, attenuation
+#define CLUSTER_LIGHT_TEXELS 3
+
+//clustered forward lighting. the view frustum is split in CLUSTERS_X x CLUSTERS_Y screen tiles and
+//CLUSTERS_Z slices spaced exponentially in view depth. every frame the lights are assigned on the CPU
+//to the clusters their range touches, the shading pass then only loops over the list of the cluster
+//of the fragment. the lists are read from buffer textures: the lights (RGBA32F), the offset and count
+//of every cluster (RG32UI) and the light indices of all clusters one after the other (R32UI)
+class LightClusters
+{
+public:
+	static const unsigned int CLUSTERS_X = 16;
+	static const unsigned int CLUSTERS_Y = 12;
+	static const unsigned int CLUSTERS_Z = 24;
+	static const unsigned int CLUSTER_COUNT = CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z;
+
+private:
+	enum Buffers
+	{
+		LIGHT_DATA,
+		GRID,
+		INDICES,
+		BUFFER_COUNT
+	};
+
+	vector<ClusterLight> lights;
+
+	//view space bounds of the clusters, rebuilt when the projection changes
+	glm::mat4 proj;
+	float nearPlane;
+	float farPlane;
+	vector<glm::vec3> boundsMin;
+	vector<glm::vec3> boundsMax;
+
+	//lights of every cluster while assigning, then flattened into grid and indices
+	vector<vector<unsigned int> > clusterLights;
+	vector<unsigned int> grid;
+	vector<unsigned int> indices;
+	vector<glm::vec4> lightData;
+
+	unsigned int buffers[BUFFER_COUNT];
+	unsigned int textures[BUFFER_COUNT];
+
+	//CPU time of the last assignment, and the longest list
+	float assignTime;
+	unsigned int maxLights;
+
+public:
+	LightClusters()
+	{
+		nearPlane = farPlane = 0.0f;
+		for (unsigned int b = 0; b < BUFFER_COUNT; b++)
+			buffers[b] = textures[b] = 0;
+		assignTime = 0.0f;
+		maxLights = 0;
+	}
+
+	void Init()
+	{
+		static const GLenum formats[BUFFER_COUNT] = { GL_RGBA32F, GL_RG32UI, GL_R32UI };
+		glGenBuffers(BUFFER_COUNT, buffers);
+		glGenTextures(BUFFER_COUNT, textures);
+		for (unsigned int b = 0; b < BUFFER_COUNT; b++)
+		{
+			//never empty, a buffer texture without storage is incomplete
+			glBindBuffer(GL_TEXTURE_BUFFER, buffers[b]);
+			glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+			glBindTexture(GL_TEXTURE_BUFFER, textures[b]);
+			glTexBuffer(GL_TEXTURE_BUFFER, formats[b], buffers[b]);
+		}
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+		clusterLights.resize(CLUSTER_COUNT);
+	}
+
+	void SetLights(const vector<ClusterLight>& newLights)
+	{
+		lights = newLights;
+	}
+
+	vector<ClusterLight>& GetLights()
+	{
+		return lights;
+	}
+
+	unsigned int GetLightCount() const
+	{
+		return lights.size();
+	}
+
+	//fills the light lists of the clusters of the camera and uploads them with the lights
+	void Assign(const glm::mat4& view, const glm::mat4& projection, float zNear, float zFar)
+	{
+		chrono::high_resolution_clock::time_point start = chrono::high_resolution_clock::now();
+
+		if (projection != proj || zNear != nearPlane || zFar != farPlane)
+			BuildBounds(projection, zNear, zFar);
+		for (unsigned int c = 0; c < CLUSTER_COUNT; c++)
+			clusterLights[c].clear();
+
+		for (unsigned int l = 0; l < lights.size(); l++)
+		{
+			glm::vec3 center = glm::vec3(view * glm::vec4(lights[l].position, 1.0f));
+			float radius = lights[l].range;
+			float depthMin = -center.z - radius;
+			float depthMax = -center.z + radius;
+			if (depthMax < nearPlane || depthMin > farPlane)
+				continue;
+
+			unsigned int z0 = Slice(max(depthMin, nearPlane));
+			unsigned int z1 = Slice(min(depthMax, farPlane));
+
+			//screen tiles of the view space box of the sphere, the corners behind the near plane are
+			//pulled onto it, which only widens the projection
+			glm::vec2 ndcMin(1.0f), ndcMax(-1.0f);
+			for (unsigned int k = 0; k < 8; k++)
+			{
+				glm::vec3 corner = center + glm::vec3(k & 1 ? radius : -radius, k & 2 ? radius : -radius, k & 4 ? radius : -radius);
+				corner.z = min(corner.z, -nearPlane);
+				glm::vec4 clip = proj * glm::vec4(corner, 1.0f);
+				glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+				ndcMin = glm::min(ndcMin, ndc);
+				ndcMax = glm::max(ndcMax, ndc);
+			}
+			if (ndcMax.x < -1.0f || ndcMin.x > 1.0f || ndcMax.y < -1.0f || ndcMin.y > 1.0f)
+				continue;
+			unsigned int x0 = Tile(ndcMin.x, CLUSTERS_X), x1 = Tile(ndcMax.x, CLUSTERS_X);
+			unsigned int y0 = Tile(ndcMin.y, CLUSTERS_Y), y1 = Tile(ndcMax.y, CLUSTERS_Y);
+
+			for (unsigned int z = z0; z <= z1; z++)
+			{
+				for (unsigned int y = y0; y <= y1; y++)
+				{
+					for (unsigned int x = x0; x <= x1; x++)
+					{
+						unsigned int c = x + CLUSTERS_X * (y + CLUSTERS_Y * z);
+						if (SphereTouchesBox(center, radius, boundsMin[c], boundsMax[c]))
+							clusterLights[c].push_back(l);
+					}
+				}
+			}
+		}
+
+		grid.resize(CLUSTER_COUNT * 2);
+		indices.clear();
+		maxLights = 0;
+		for (unsigned int c = 0; c < CLUSTER_COUNT; c++)
+		{
+			grid[c * 2] = indices.size();
+			grid[c * 2 + 1] = clusterLights[c].size();
+			indices.insert(indices.end(), clusterLights[c].begin(), clusterLights[c].end());
+			maxLights = max(maxLights, (unsigned int)clusterLights[c].size());
+		}
+
+		lightData.resize(lights.size() * CLUSTER_LIGHT_TEXELS);
+		for (unsigned int l = 0; l < lights.size(); l++)
+		{
+			lightData[l * CLUSTER_LIGHT_TEXELS] = glm::vec4(lights[l].position, lights[l].range);
+			lightData[l * CLUSTER_LIGHT_TEXELS + 1] = glm::vec4(lights[l].diffuse, 0.0f);
+			lightData[l * CLUSTER_LIGHT_TEXELS + 2] = glm::vec4(lights[l].attenuation, 0.0f);
+		}
+
+		Upload(buffers[LIGHT_DATA], lightData.size() * sizeof(glm::vec4), lightData.empty() ? NULL : &lightData[0]);
+		Upload(buffers[GRID], grid.size() * sizeof(unsigned int), &grid[0]);
+		Upload(buffers[INDICES], indices.size() * sizeof(unsigned int), indices.empty() ? NULL : &indices[0]);
+
+		assignTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+	//binds the buffer textures to their units
+	void Bind() const
+	{
+		glActiveTexture(GL_TEXTURE0 + CLUSTER_LIGHTS_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[LIGHT_DATA]);
+		glActiveTexture(GL_TEXTURE0 + CLUSTER_GRID_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[GRID]);
+		glActiveTexture(GL_TEXTURE0 + CLUSTER_INDICES_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[INDICES]);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	//the fragment shader finds its slice with log(depth) * scale + bias
+	glm::vec2 GetSliceScaleBias() const
+	{
+		float scale = CLUSTERS_Z / log(farPlane / nearPlane);
+		return glm::vec2(scale, -log(nearPlane) * scale);
+	}
+
+	float GetAssignTime() const
+	{
+		return assignTime;
+	}
+
+	unsigned int GetMaxLights() const
+	{
+		return maxLights;
+	}
+
+	float GetAverageLights() const
+	{
+		return indices.size() / (float)CLUSTER_COUNT;
+	}
+
+	//deletes the GL objects, must be called while the context is alive
+	void Release()
+	{
+		if (buffers[0] != 0)
+		{
+			glDeleteBuffers(BUFFER_COUNT, buffers);
+			glDeleteTextures(BUFFER_COUNT, textures);
+		}
+		for (unsigned int b = 0; b < BUFFER_COUNT; b++)
+			buffers[b] = textures[b] = 0;
+	}
+
+private:
+	//the box of every cluster around the corners of its tile at the two depths of its slice
+	void BuildBounds(const glm::mat4& projection, float zNear, float zFar)
+	{
+		proj = projection;
+		nearPlane = zNear;
+		farPlane = zFar;
+		boundsMin.resize(CLUSTER_COUNT);
+		boundsMax.resize(CLUSTER_COUNT);
+
+		glm::mat4 inverse = glm::inverse(proj);
+		for (unsigned int z = 0; z < CLUSTERS_Z; z++)
+		{
+			float depth0 = SliceDepth(z);
+			float depth1 = SliceDepth(z + 1);
+			for (unsigned int y = 0; y < CLUSTERS_Y; y++)
+			{
+				for (unsigned int x = 0; x < CLUSTERS_X; x++)
+				{
+					unsigned int c = x + CLUSTERS_X * (y + CLUSTERS_Y * z);
+					boundsMin[c] = glm::vec3(1e30f);
+					boundsMax[c] = glm::vec3(-1e30f);
+					for (unsigned int k = 0; k < 4; k++)
+					{
+						glm::vec2 ndc(((x + (k & 1)) / (float)CLUSTERS_X) * 2.0f - 1.0f, ((y + (k >> 1)) / (float)CLUSTERS_Y) * 2.0f - 1.0f);
+						glm::vec4 point = inverse * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+						//direction through the corner with a view depth of 1
+						glm::vec3 ray = glm::vec3(point) / -point.z;
+						boundsMin[c] = glm::min(boundsMin[c], glm::min(ray * depth0, ray * depth1));
+						boundsMax[c] = glm::max(boundsMax[c], glm::max(ray * depth0, ray * depth1));
+					}
+				}
+			}
+		}
+	}
+
+	float SliceDepth(unsigned int slice) const
+	{
+		return nearPlane * pow(farPlane / nearPlane, slice / (float)CLUSTERS_Z);
+	}
+
+	unsigned int Slice(float depth) const
+	{
+		int slice = (int)(log(depth / nearPlane) / log(farPlane / nearPlane) * CLUSTERS_Z);
+		return min(max(slice, 0), (int)CLUSTERS_Z - 1);
+	}
+
+	static unsigned int Tile(float ndc, unsigned int tiles)
+	{
+		int tile = (int)((ndc * 0.5f + 0.5f) * tiles);
+		return min(max(tile, 0), (int)tiles - 1);
+	}
+
+	static bool SphereTouchesBox(const glm::vec3& center, float radius, const glm::vec3& boxMin, const glm::vec3& boxMax)
+	{
+		glm::vec3 closest = glm::clamp(center, boxMin, boxMax);
+		glm::vec3 d = center - closest;
+		return glm::dot(d, d) <= radius * radius;
+	}
+
+	static void Upload(unsigned int buffer, size_t size, const void* data)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		//orphans the storage of the previous frame, a buffer texture must not be empty
+		glBufferData(GL_TEXTURE_BUFFER, max(size, (size_t)16), NULL, GL_STREAM_DRAW);
+		if (size > 0)
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+};
@@ -6,6 +6,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "shader.h"
+#include "GeometryArena.h"
 
 #include <string>
 #include <fstream>
@@ -14,23 +15,21 @@
 #include <vector>
 using namespace std;
 
-struct Vertex {
-	// position
-	glm::vec3 Position;
-	// normal
-	glm::vec3 Normal;
-	// texCoords
-	glm::vec2 TexCoords;
-	// tangent
-	glm::vec3 Tangent;
-	// bitangent
-	glm::vec3 Bitangent;
+// how the alpha channel of a texture is drawn
+enum TextureAlpha {
+	// no alpha channel or every texel is opaque
+	ALPHA_OPAQUE,
+	// texels are either (nearly) clear or opaque, alpha tested with the opaque meshes
+	ALPHA_CUTOUT,
+	// a real share of the texels is partially transparent, blended back to front
+	ALPHA_BLENDED
 };
 
 struct Texture {
 	unsigned int id;
 	string type;
 	string path;
+	TextureAlpha alpha;
 };
 
 class Mesh {
@@ -39,22 +38,57 @@ public:
 	vector<Vertex> vertices;
 	vector<unsigned int> indices;
 	vector<Texture> textures;
+	// VAO of the arena block the mesh was placed in and the location of the mesh inside it
 	unsigned int VAO;
+	// VAO of the same block that reads the position stream only
+	unsigned int depthVAO;
+	unsigned int baseVertex;
+	unsigned int firstIndex;
+	unsigned int meshID;
+	// meshes that bind the same textures share the id, used for sorting draws by material
+	unsigned int materialID;
+	// MTL dissolve (d), multiplied with the alpha of the diffuse texture
+	float opacity;
+	// drawn blended after the opaque meshes, back to front
+	bool transparent;
+	// drawn with the opaque meshes, the texels of the diffuse map with alpha below 0.5 are discarded
+	bool cutout;
 
 	/*  Functions  */
 	// constructor
-	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+	Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, float opacity = 1.0f)
 	{
 		this->vertices = vertices;
 		this->indices = indices;
 		this->textures = textures;
+		this->opacity = opacity;
+
+		// transparent when the material is not fully opaque or the diffuse map is blended,
+		// a diffuse map with a cut out alpha keeps the mesh opaque
+		transparent = opacity < 1.0f;
+		cutout = false;
+		for (unsigned int i = 0; i < textures.size(); i++)
+		{
+			if (textures[i].type == "texture_diffuse" && textures[i].alpha == ALPHA_BLENDED)
+				transparent = true;
+			if (textures[i].type == "texture_diffuse" && textures[i].alpha == ALPHA_CUTOUT)
+				cutout = true;
+		}
+		cutout = cutout && !transparent;
 
 		// now that we have all the required data, set the vertex buffers and its attribute pointers.
 		setupMesh();
+		materialID = registerMaterial(textures, opacity);
 	}
 
-	// render the mesh
-	void Draw(Shader shader)
+	// assimp meshes can come without vertices or faces, they are not placed in the arena and not drawn
+	bool IsEmpty() const
+	{
+		return vertices.empty() || indices.empty();
+	}
+
+	// binds the mesh textures to consecutive texture units and points the samplers of the shader to them
+	void BindMaterial(const Shader& shader) const
 	{
 		// bind appropriate textures
 		unsigned int diffuseNr = 1;
@@ -83,57 +117,42 @@ public:
 		}
 
 		shader.setFloat("material.shininess", 256.0f);
-
-		// draw mesh
-		glBindVertexArray(VAO);
-		glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+		shader.setFloat("material.opacity", opacity);
+		shader.setBool("material.cutout", cutout);
 
 		// always good practice to set everything back to defaults once configured.
 		glActiveTexture(GL_TEXTURE0);
 	}
 
 private:
-	/*  Render data  */
-	unsigned int VBO, EBO;
-
 	/*  Functions    */
-	// initializes all the buffer objects/arrays
+	// copies the vertices and indices into the shared geometry arena
 	void setupMesh()
 	{
-		// create buffers/arrays
-		glGenVertexArrays(1, &VAO);
-		glGenBuffers(1, &VBO);
-		glGenBuffers(1, &EBO);
-
-		glBindVertexArray(VAO);
-		// load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, VBO);
-		// A great thing about structs is that their memory layout is sequential for all its items.
-		// The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-		// again translates to 3/2 floats which translates to a byte array.
-		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-		// set the vertex attribute pointers
-		// vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-		// vertex normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-		// vertex texture coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-		// vertex tangent
-		glEnableVertexAttribArray(3);
-		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-		// vertex bitangent
-		glEnableVertexAttribArray(4);
-		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-
-		glBindVertexArray(0);
+		ArenaAllocation allocation = GeometryArena::Get().Allocate(vertices, indices);
+		VAO = allocation.VAO;
+		depthVAO = allocation.depthVAO;
+		baseVertex = allocation.baseVertex;
+		firstIndex = allocation.firstIndex;
+		meshID = allocation.id;
+	}
+
+	// returns the index of the texture set and opacity in a list of all materials seen so far
+	static unsigned int registerMaterial(const vector<Texture>& textures, float opacity)
+	{
+		static vector<vector<unsigned int>> materials;
+
+		vector<unsigned int> ids;
+		for (unsigned int i = 0; i < textures.size(); i++)
+			ids.push_back(textures[i].id);
+		ids.push_back((unsigned int)(opacity * 255.0f));
+
+		for (unsigned int i = 0; i < materials.size(); i++)
+		{
+			if (materials[i] == ids)
+				return i;
+		}
+		materials.push_back(ids);
+		return materials.size() - 1;
 	}
 };
@@ -22,7 +22,7 @@
 #include <vector>
 using namespace std;
 
-bool LoadTexture(const char* filename, GLuint& texID);
+bool LoadTexture(const char* filename, GLuint& texID, TextureAlpha* alpha = NULL);
 
 class Model
 {
@@ -39,13 +39,6 @@ public:
 	{
 	}
 
-	// draws the model, and thus all its meshes
-	void Draw(Shader shader)
-	{
-		for (unsigned int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shader);
-	}
-
 	void LoadModel(string const &path)
 	{
 		loadModel(path);
@@ -167,8 +160,13 @@ private:
 		std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
 		textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
 
+		// 5. dissolve, the OBJ importer reads the MTL d into the opacity
+		float opacity = 1.0f;
+		if (material->Get(AI_MATKEY_OPACITY, opacity) != AI_SUCCESS)
+			opacity = 1.0f;
+
 		// return a mesh object created from the extracted mesh data
-		return Mesh(vertices, indices, textures);
+		return Mesh(vertices, indices, textures, opacity);
 	}
 
 	// checks all material textures of a given type and loads the textures if they're not loaded yet.
@@ -195,7 +193,7 @@ private:
 			{   // if texture hasn't been loaded already, load it
 				Texture texture;
 				string path = directory + '/' + string(str.C_Str());
-				if (!LoadTexture(path.c_str(), texture.id))
+				if (!LoadTexture(path.c_str(), texture.id, &texture.alpha))
 				{
 					std::cout << "Unable to load texture " << str.C_Str() << endl;
 				}
@@ -211,8 +209,12 @@ private:
 
 
 
-bool LoadTexture(const char* filename, GLuint& texID)
+//alpha (optional) receives how the alpha channel is drawn, see TextureAlpha
+bool LoadTexture(const char* filename, GLuint& texID, TextureAlpha* alpha)
 {
+	if (alpha != NULL)
+		*alpha = ALPHA_OPAQUE;
+
 	glGenTextures(1, &texID);
 	glBindTexture(GL_TEXTURE_2D, texID);
 	// set the texture wrapping/filtering options (on the currently bound texture object)
@@ -241,6 +243,25 @@ bool LoadTexture(const char* filename, GLuint& texID)
 		format = GL_RGB;
 		break;
 	}
+	//cut outs (leaves, fences) are clear or opaque apart from their filtered edges, they are alpha
+	//tested in the opaque pass. only more than 10% of partially transparent texels are worth blending
+	if (alpha != NULL && channels == 4)
+	{
+		int partial = 0, clear = 0;
+		for (int i = 0; i < width * height; i++)
+		{
+			unsigned char a = img_data[i * 4 + 3];
+			if (a == 0)
+				clear++;
+			else if (a < 250)
+				partial++;
+		}
+		if (partial * 10 > width * height)
+			*alpha = ALPHA_BLENDED;
+		else if (partial + clear > 0)
+			*alpha = ALPHA_CUTOUT;
+	}
+
 	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, img_data);
 	glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -38,10 +38,11 @@ public:
 	{
 		this->name = name;
 		ID = ++genID;
+		type = t;
 	}
 
-	virtual void Traverse() = 0;
-	virtual void TraverseShadows() = 0;
-	virtual void TraverseIntersection(const glm::vec3& rayOrigin, const glm::vec3& rayDirection, vector<Intersection*>& hits, vector<Node*>& path) = 0;
-	virtual void TraverseCollisions(BoundingBox& player, const glm::vec3& velocity, vector<collision*>& collisions) = 0;
+	NodeType GetType() const
+	{
+		return type;
+	}
 };
\ No newline at end of file
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "LightClusters.h"
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+using namespace std;
+
+//texture unit of the light lists of the draws
+#define OBJECT_LIGHTS_TEXTURE_UNIT 17
+
+//how the unshadowed lights of a fragment are found
+enum LightAssignment
+{
+	//every light, to compare against
+	LIGHTS_ALL,
+	//the list of the draw (ObjectLights)
+	LIGHTS_PER_OBJECT,
+	//the list of the cluster of the fragment (LightClusters)
+	LIGHTS_CLUSTERED,
+	LIGHT_ASSIGNMENTS
+};
+
+//light lists per scene object of the main pass. every light is a sphere with the range its attenuation
+//reaches, the scene queries its bounding volume hierarchy with each sphere (SceneBVH::SubmitLights) and
+//hands over the objects it reaches. the first draw of a visible object writes the list of the object, the
+//other draws of the object (meshes, instances) point their records at the same list. a list starts with a
+//header, the mask of the shadowed lamps in the low 8 bits and the count of unshadowed lights above them,
+//followed by the indices of those lights in the light buffer of the clusters. the lists are read from a
+//buffer texture (R32UI)
+class ObjectLights
+{
+public:
+	static const unsigned int MAX_LAMPS = 8;
+
+private:
+	//position and range of the shadowed lamps, a lamp with a range of 0 is in no list
+	vector<glm::vec4> lamps;
+	//unshadowed lights, NULL when only the lamps are listed
+	const vector<ClusterLight>* lights;
+	//per scene object, the lamps (bit per lamp) and the unshadowed lights that reach its box
+	vector<unsigned int> objectLamps;
+	vector<vector<unsigned int>> objectLights;
+	//offset of the list of each object, ~0u until a draw of the object asks for it
+	vector<unsigned int> offsets;
+	vector<unsigned int> lists;
+
+	unsigned int buffer;
+	unsigned int texture;
+
+	//CPU time of the last assignment and build, lists and unshadowed lights in them, and the longest list
+	chrono::high_resolution_clock::time_point start;
+	float assignTime;
+	float buildTime;
+	unsigned int listCount;
+	unsigned int maxLights;
+
+public:
+	ObjectLights()
+	{
+		lights = NULL;
+		buffer = texture = 0;
+		assignTime = buildTime = 0.0f;
+		listCount = maxLights = 0;
+	}
+
+	void Init()
+	{
+		glGenBuffers(1, &buffer);
+		glGenTextures(1, &texture);
+		//never empty, a buffer texture without storage is incomplete
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	}
+
+	//the lamp with index i is bit i of the mask, MAX_LAMPS at most
+	void SetLamps(const vector<glm::vec4>& spheres)
+	{
+		lamps.assign(spheres.begin(), spheres.begin() + min((unsigned int)spheres.size(), MAX_LAMPS));
+	}
+
+	void SetLights(const vector<ClusterLight>* unshadowed)
+	{
+		lights = unshadowed;
+	}
+
+	unsigned int GetLampCount() const
+	{
+		return lamps.size();
+	}
+
+	const glm::vec4& GetLamp(unsigned int lamp) const
+	{
+		return lamps[lamp];
+	}
+
+	unsigned int GetLightCount() const
+	{
+		return lights != NULL ? lights->size() : 0;
+	}
+
+	const ClusterLight& GetLight(unsigned int light) const
+	{
+		return (*lights)[light];
+	}
+
+	//called by the scene before it adds the objects the lights reach, objects is the number of scene objects
+	void BeginAssign(unsigned int objects)
+	{
+		start = chrono::high_resolution_clock::now();
+		objectLamps.assign(objects, 0);
+		objectLights.resize(objects);
+		for (unsigned int i = 0; i < objects; i++)
+			objectLights[i].clear();
+	}
+
+	void AddLamp(unsigned int object, unsigned int lamp)
+	{
+		objectLamps[object] |= 1u << lamp;
+	}
+
+	//the lights are added in ascending order, the lists keep it
+	void AddLight(unsigned int object, unsigned int light)
+	{
+		objectLights[object].push_back(light);
+	}
+
+	void EndAssign()
+	{
+		assignTime = chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+	//called by the render queue before the draw records of the main pass
+	void Begin()
+	{
+		start = chrono::high_resolution_clock::now();
+		lists.clear();
+		offsets.assign(objectLamps.size(), ~0u);
+		listCount = maxLights = 0;
+	}
+
+	//returns where the list of the object starts, it is written by the first draw of the object.
+	//draws of objects the scene did not assign (~0u) get a list of their own from their box
+	unsigned int Build(unsigned int object, const glm::vec3& center, const glm::vec3& extent)
+	{
+		if (object >= offsets.size())
+			return BuildFromBox(center, extent);
+		if (offsets[object] != ~0u)
+			return offsets[object];
+
+		offsets[object] = lists.size();
+		lists.push_back(objectLamps[object] | (objectLights[object].size() << 8));
+		lists.insert(lists.end(), objectLights[object].begin(), objectLights[object].end());
+		Counted(objectLights[object].size());
+		return offsets[object];
+	}
+
+	//uploads the lists of the frame
+	void End()
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		//orphans the storage of the previous frame, a buffer texture must not be empty
+		size_t size = lists.size() * sizeof(unsigned int);
+		glBufferData(GL_TEXTURE_BUFFER, max(size, (size_t)16), NULL, GL_STREAM_DRAW);
+		if (size > 0)
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, size, &lists[0]);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		buildTime = assignTime + chrono::duration<float, milli>(chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void Bind() const
+	{
+		glActiveTexture(GL_TEXTURE0 + OBJECT_LIGHTS_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	float GetBuildTime() const
+	{
+		return buildTime;
+	}
+
+	//unshadowed lights per draw
+	float GetAverageLights() const
+	{
+		return listCount == 0 ? 0.0f : (lists.size() - listCount) / (float)listCount;
+	}
+
+	unsigned int GetMaxLights() const
+	{
+		return maxLights;
+	}
+
+	static const char* GetAssignmentName(LightAssignment assignment)
+	{
+		switch (assignment)
+		{
+		case LIGHTS_PER_OBJECT:
+			return "per object";
+		case LIGHTS_CLUSTERED:
+			return "clustered";
+		default:
+			return "all per fragment";
+		}
+	}
+
+	//deletes the GL objects, must be called while the context is alive
+	void Release()
+	{
+		if (buffer != 0)
+		{
+			glDeleteBuffers(1, &buffer);
+			glDeleteTextures(1, &texture);
+		}
+		buffer = texture = 0;
+	}
+
+private:
+	void Counted(unsigned int count)
+	{
+		listCount++;
+		maxLights = max(maxLights, count);
+	}
+
+	//every light tested against the box
+	unsigned int BuildFromBox(const glm::vec3& center, const glm::vec3& extent)
+	{
+		unsigned int offset = lists.size();
+		unsigned int mask = 0;
+		for (unsigned int l = 0; l < lamps.size(); l++)
+		{
+			if (lamps[l].w > 0.0f && Touches(glm::vec3(lamps[l]), lamps[l].w, center, extent))
+				mask |= 1u << l;
+		}
+
+		lists.push_back(mask);
+		for (unsigned int l = 0; l < GetLightCount(); l++)
+		{
+			if (Touches(GetLight(l).position, GetLight(l).range, center, extent))
+				lists.push_back(l);
+		}
+
+		unsigned int count = lists.size() - offset - 1;
+		lists[offset] |= count << 8;
+		Counted(count);
+		return offset;
+	}
+
+	//squared distance from the center of the sphere to the closest point of the box
+	static bool Touches(const glm::vec3& position, float range, const glm::vec3& center, const glm::vec3& extent)
+	{
+		glm::vec3 offset = glm::max(glm::abs(position - center) - extent, glm::vec3(0.0f));
+		return glm::dot(offset, offset) <= range * range;
+	}
+};
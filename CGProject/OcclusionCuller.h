@@ -0,0 +1,234 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "OcclusionTest.h"
+
+#include <vector>
+#include <cstdio>
+using namespace std;
+
+//hardware occlusion culling with GL_ANY_SAMPLES_PASSED queries on the bounding boxes of the objects.
+//the results are only read when they are available, an object is skipped when its box was hidden
+//the last time it got an answer, and drawn while its query is still in flight (no stalls).
+//the boxes are tested after the main pass against its depth buffer, objects hidden this frame
+//keep their query going so that they come back as soon as they are uncovered
+class OcclusionCuller : public IOcclusionTest
+{
+	struct ObjectState
+	{
+		unsigned int query;
+		bool pending;
+		bool occluded;
+		//frame the query was issued in
+		unsigned int issuedFrame;
+		//last frame the object was inside the view frustum
+		unsigned int seenFrame;
+		glm::vec3 boundsMin, boundsMax;
+	};
+
+	vector<ObjectState> objects;
+	//objects inside the view frustum this frame, tested after the main pass
+	vector<unsigned int> tested;
+	unsigned int frame;
+	bool enabled;
+
+	Shader* shader;
+	unsigned int VAO, VBO;
+
+	//stats of the last frame
+	unsigned int occludedCount;
+	unsigned int resultCount;
+	unsigned int latencySum;
+
+public:
+	OcclusionCuller()
+	{
+		frame = 0;
+		enabled = false;
+		shader = NULL;
+		VAO = VBO = 0;
+		occludedCount = resultCount = latencySum = 0;
+	}
+
+	void Init(Shader* boxShader)
+	{
+		shader = boxShader;
+
+		//unit cube, 12 triangles
+		float vertices[] = {
+			0,0,0, 1,0,0, 1,1,0,  0,0,0, 1,1,0, 0,1,0,
+			0,0,1, 1,1,1, 1,0,1,  0,0,1, 0,1,1, 1,1,1,
+			0,0,0, 0,1,1, 0,0,1,  0,0,0, 0,1,0, 0,1,1,
+			1,0,0, 1,0,1, 1,1,1,  1,0,0, 1,1,1, 1,1,0,
+			0,0,0, 0,0,1, 1,0,1,  0,0,0, 1,0,1, 1,0,0,
+			0,1,0, 1,1,1, 0,1,1,  0,1,0, 1,1,0, 1,1,1,
+		};
+		glGenVertexArrays(1, &VAO);
+		glGenBuffers(1, &VBO);
+		glBindVertexArray(VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, VBO);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	void SetEnabled(bool enable)
+	{
+		enabled = enable;
+	}
+
+	bool IsEnabled() const
+	{
+		return enabled;
+	}
+
+	//collects the results that arrived since the last frame, never waits for the GPU
+	void BeginFrame()
+	{
+		frame++;
+		tested.clear();
+		occludedCount = 0;
+		resultCount = 0;
+		latencySum = 0;
+
+		for (unsigned int i = 0; i < objects.size(); i++)
+		{
+			ObjectState& object = objects[i];
+			if (!object.pending)
+				continue;
+
+			GLuint available = 0;
+			glGetQueryObjectuiv(object.query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available)
+				continue;
+
+			GLuint samples = 0;
+			glGetQueryObjectuiv(object.query, GL_QUERY_RESULT, &samples);
+			object.occluded = samples == 0;
+			object.pending = false;
+			resultCount++;
+			latencySum += frame - object.issuedFrame;
+		}
+	}
+
+	//called for every object inside the view frustum, false when the object can be skipped.
+	//the answer is only trusted when the object was in view the frame before, otherwise
+	//the result belongs to an older camera position
+	bool IsVisible(unsigned int object, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& viewPosition)
+	{
+		if (!enabled || object == ~0u)
+			return true;
+
+		if (object >= objects.size())
+		{
+			ObjectState state;
+			state.query = 0;
+			state.pending = false;
+			state.occluded = false;
+			state.issuedFrame = 0;
+			state.seenFrame = 0;
+			objects.resize(object + 1, state);
+		}
+
+		ObjectState& state = objects[object];
+		bool wasSeen = state.seenFrame + 1 >= frame;
+		//an object is asked once per mesh, it is counted and tested once
+		bool first = state.seenFrame != frame;
+		if (first)
+		{
+			state.seenFrame = frame;
+			state.boundsMin = boundsMin;
+			state.boundsMax = boundsMax;
+			tested.push_back(object);
+		}
+
+		//the near plane clips the box when the camera is inside it, the query would report it hidden
+		glm::vec3 low = boundsMin - glm::vec3(0.2f);
+		glm::vec3 high = boundsMax + glm::vec3(0.2f);
+		if (viewPosition.x >= low.x && viewPosition.y >= low.y && viewPosition.z >= low.z &&
+			viewPosition.x <= high.x && viewPosition.y <= high.y && viewPosition.z <= high.z)
+		{
+			state.occluded = false;
+			return true;
+		}
+
+		bool occluded = wasSeen && state.occluded;
+		if (occluded && first)
+			occludedCount++;
+		return !occluded;
+	}
+
+	//draws the boxes of the objects in view against the depth buffer of the main pass,
+	//objects with a query still in flight are skipped
+	void IssueQueries(const glm::mat4& viewProj)
+	{
+		if (!enabled || tested.empty())
+			return;
+
+		glUseProgram(shader->ID);
+		shader->setMat4("viewProj", viewProj);
+		glBindVertexArray(VAO);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		glDepthMask(GL_FALSE);
+
+		for (unsigned int i = 0; i < tested.size(); i++)
+		{
+			ObjectState& state = objects[tested[i]];
+			if (state.pending)
+				continue;
+
+			if (state.query == 0)
+				glGenQueries(1, &state.query);
+
+			shader->setVec3("boxMin", state.boundsMin);
+			shader->setVec3("boxMax", state.boundsMax);
+			glBeginQuery(GL_ANY_SAMPLES_PASSED, state.query);
+			glDrawArrays(GL_TRIANGLES, 0, 36);
+			glEndQuery(GL_ANY_SAMPLES_PASSED);
+			state.pending = true;
+			state.issuedFrame = frame;
+		}
+
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDepthMask(GL_TRUE);
+		glBindVertexArray(0);
+	}
+
+	unsigned int GetOccludedCount() const
+	{
+		return occludedCount;
+	}
+
+	unsigned int GetTestedCount() const
+	{
+		return tested.size();
+	}
+
+	//average number of frames between issuing a query and reading its result
+	float GetAverageLatency() const
+	{
+		return resultCount == 0 ? 0.0f : (float)latencySum / resultCount;
+	}
+
+	//deletes the GL objects, must be called while the context is alive
+	void Release()
+	{
+		for (unsigned int i = 0; i < objects.size(); i++)
+		{
+			if (objects[i].query != 0)
+				glDeleteQueries(1, &objects[i].query);
+		}
+		objects.clear();
+		if (VAO != 0)
+		{
+			glDeleteVertexArrays(1, &VAO);
+			glDeleteBuffers(1, &VBO);
+		}
+		VAO = VBO = 0;
+	}
+};
\ No newline at end of file
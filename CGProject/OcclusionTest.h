@@ -0,0 +1,12 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+//answers whether a scene object can be seen this frame, asked by the render queue for
+//every draw that passed the frustum test before the main pass is built
+class IOcclusionTest
+{
+public:
+	//object identifies the scene object across frames, boundsMin and boundsMax are its world space box
+	virtual bool IsVisible(unsigned int object, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& viewPosition) = 0;
+};
\ No newline at end of file
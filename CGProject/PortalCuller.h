@@ -0,0 +1,395 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "SceneBVH.h"
+#include "Frustum.h"
+#include "BoundingObjects.h"
+#include "OcclusionTest.h"
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+using namespace std;
+
+//a room of the building, the outside is a cell too
+struct Cell
+{
+	string name;
+	//the space inside the cell, the geometry on its border (walls, floor, windows)
+	//belongs to the cells on both sides
+	Bounds bounds;
+	vector<unsigned int> portals;
+	//scene instances of the cell
+	vector<unsigned int> instances;
+	//frustums the cell was reached with this frame
+	vector<Frustum> views;
+	unsigned int visitedFrame;
+};
+
+//an opening between two cells (door, window), a quad in world space
+struct Portal
+{
+	unsigned int cells[2];
+	//the node the portal is made from, its world box is flattened along the thinnest axis
+	Node* opening;
+	Bounds box;
+	glm::vec3 corners[4];
+	glm::vec3 normal;
+};
+
+//cell and portal visibility: the view frustum is narrowed through every portal of the camera cell
+//that it sees, then recursively through the portals of the cells behind them. only the instances
+//of the cells reached this way are tested, so the cost follows what is visible and not the size
+//of the building. the cells and portals are defined with the scene, Build ties them to the instances
+class PortalCuller : public IOcclusionTest
+{
+	//portals passed through on one path
+	static const unsigned int MAX_DEPTH = 8;
+	//frustums kept per cell, a cell reached more often is tested with the view frustum
+	static const unsigned int MAX_VIEWS = 4;
+
+	vector<Cell> cells;
+	vector<Portal> portals;
+	const SceneBVH* scene;
+	//cells of every instance, empty when the instance is not inside any cell
+	vector<vector<unsigned int> > instanceCells;
+	vector<unsigned int> visibleFrame;
+
+	unsigned int frame;
+	bool enabled;
+	int cameraCell;
+	glm::vec3 eye;
+	Frustum viewFrustum;
+	//cells on the current path of the recursion, and all cells reached this frame
+	vector<unsigned int> path;
+	vector<unsigned int> reached;
+	unsigned int visibleCount;
+
+public:
+	PortalCuller()
+	{
+		scene = NULL;
+		frame = 0;
+		enabled = true;
+		cameraCell = -1;
+		visibleCount = 0;
+	}
+
+	unsigned int AddCell(const string& name, const glm::vec3& lowest, const glm::vec3& highest)
+	{
+		Cell cell;
+		cell.name = name;
+		cell.bounds = Bounds(lowest, highest);
+		cell.visitedFrame = 0;
+		cells.push_back(cell);
+		return cells.size() - 1;
+	}
+
+	void AddPortal(unsigned int cellA, unsigned int cellB, Node* opening)
+	{
+		Portal portal;
+		portal.cells[0] = cellA;
+		portal.cells[1] = cellB;
+		portal.opening = opening;
+		portals.push_back(portal);
+		cells[cellA].portals.push_back(portals.size() - 1);
+		cells[cellB].portals.push_back(portals.size() - 1);
+	}
+
+	//sorts the instances into the cells and makes the portal quads from their openings,
+	//needed again after SceneBVH::Build
+	void Build(const SceneBVH& index)
+	{
+		scene = &index;
+		for (unsigned int c = 0; c < cells.size(); c++)
+			cells[c].instances.clear();
+		instanceCells.assign(index.GetInstanceCount(), vector<unsigned int>());
+		visibleFrame.assign(index.GetInstanceCount(), 0);
+		for (unsigned int i = 0; i < index.GetInstanceCount(); i++)
+			Assign(i);
+
+		for (unsigned int p = 0; p < portals.size(); p++)
+		{
+			Portal& portal = portals[p];
+			portal.box = Bounds();
+			for (unsigned int i = 0; i < index.GetInstanceCount(); i++)
+			{
+				const SceneInstance& instance = index.GetInstance(i);
+				if (instance.node == portal.opening ||
+					find(instance.path.begin(), instance.path.end(), portal.opening) != instance.path.end())
+					portal.box.Add(instance.bounds);
+			}
+			if (portal.box.empty)
+			{
+				printf("portal %u: the opening %s has no geometry\n", p, portal.opening->GetName().c_str());
+				continue;
+			}
+
+			//the quad lies in the middle of the thinnest side of the box
+			glm::vec3 size = portal.box.highest - portal.box.lowest;
+			int axis = size.x < size.y ? (size.x < size.z ? 0 : 2) : (size.y < size.z ? 1 : 2);
+			int u = (axis + 1) % 3, v = (axis + 2) % 3;
+			glm::vec3 center = (portal.box.lowest + portal.box.highest) * 0.5f;
+			for (int k = 0; k < 4; k++)
+			{
+				glm::vec3 corner = center;
+				corner[u] = (k == 1 || k == 2) ? portal.box.highest[u] : portal.box.lowest[u];
+				corner[v] = (k >= 2) ? portal.box.highest[v] : portal.box.lowest[v];
+				portal.corners[k] = corner;
+			}
+			portal.normal = glm::vec3(0.0f);
+			portal.normal[axis] = 1.0f;
+		}
+	}
+
+	void SetEnabled(bool enable)
+	{
+		enabled = enable;
+	}
+
+	bool IsEnabled() const
+	{
+		return enabled;
+	}
+
+	//finds the cells seen from the camera and marks their visible instances,
+	//called after SceneBVH::Refit so that moved instances change cells
+	void Update(const glm::vec3& viewPosition, const Frustum& frustum)
+	{
+		frame++;
+		visibleCount = 0;
+		reached.clear();
+		cameraCell = -1;
+		if (!enabled || scene == NULL)
+			return;
+
+		const vector<unsigned int>& refitted = scene->GetRefitted();
+		for (unsigned int i = 0; i < refitted.size(); i++)
+			Assign(refitted[i]);
+
+		cameraCell = FindCell(viewPosition);
+		if (cameraCell < 0)
+			return;
+
+		eye = viewPosition;
+		viewFrustum = frustum;
+		Visit(cameraCell, frustum, 0);
+
+		for (unsigned int r = 0; r < reached.size(); r++)
+		{
+			const Cell& cell = cells[reached[r]];
+			for (unsigned int i = 0; i < cell.instances.size(); i++)
+			{
+				unsigned int instance = cell.instances[i];
+				if (visibleFrame[instance] == frame)
+					continue;
+
+				const Bounds& b = scene->GetInstance(instance).bounds;
+				for (unsigned int v = 0; v < cell.views.size(); v++)
+				{
+					if (cell.views[v].IsBoxVisible(b.lowest, b.highest))
+					{
+						visibleFrame[instance] = frame;
+						visibleCount++;
+						break;
+					}
+				}
+			}
+		}
+	}
+
+	//objects outside of all cells, and everything while the camera is outside of all cells, stay visible
+	bool IsVisible(unsigned int object, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& viewPosition)
+	{
+		if (cameraCell < 0 || object >= instanceCells.size() || instanceCells[object].empty())
+			return true;
+		return visibleFrame[object] == frame;
+	}
+
+	unsigned int GetCellCount() const
+	{
+		return cells.size();
+	}
+
+	unsigned int GetReachedCount() const
+	{
+		return reached.size();
+	}
+
+	unsigned int GetVisibleCount() const
+	{
+		return visibleCount;
+	}
+
+	const char* GetCameraCellName() const
+	{
+		return cameraCell < 0 ? "none" : cells[cameraCell].name.c_str();
+	}
+
+private:
+	static float Volume(const Bounds& b)
+	{
+		glm::vec3 size = b.highest - b.lowest;
+		return size.x * size.y * size.z;
+	}
+
+	static bool Contains(const Bounds& outer, const Bounds& inner)
+	{
+		//a surface lying on the border of the cell counts as crossing it
+		const float eps = 0.01f;
+		return inner.lowest.x > outer.lowest.x + eps && inner.lowest.y > outer.lowest.y + eps && inner.lowest.z > outer.lowest.z + eps &&
+			inner.highest.x < outer.highest.x - eps && inner.highest.y < outer.highest.y - eps && inner.highest.z < outer.highest.z - eps;
+	}
+
+	static bool Overlaps(const Bounds& a, const Bounds& b)
+	{
+		return !(a.highest.x < b.lowest.x || a.lowest.x > b.highest.x ||
+			a.highest.y < b.lowest.y || a.lowest.y > b.highest.y ||
+			a.highest.z < b.lowest.z || a.lowest.z > b.highest.z);
+	}
+
+	//smallest cell containing the point
+	int FindCell(const glm::vec3& point) const
+	{
+		int best = -1;
+		for (unsigned int c = 0; c < cells.size(); c++)
+		{
+			const Bounds& b = cells[c].bounds;
+			if (point.x < b.lowest.x || point.y < b.lowest.y || point.z < b.lowest.z ||
+				point.x > b.highest.x || point.y > b.highest.y || point.z > b.highest.z)
+				continue;
+			if (best < 0 || Volume(b) < Volume(cells[best].bounds))
+				best = c;
+		}
+		return best;
+	}
+
+	//an instance belongs to the smallest cell containing it and to the cells nested in that one
+	//which it overlaps, so a wall is part of the rooms on both of its sides
+	void Assign(unsigned int instance)
+	{
+		vector<unsigned int>& owners = instanceCells[instance];
+		for (unsigned int k = 0; k < owners.size(); k++)
+		{
+			vector<unsigned int>& list = cells[owners[k]].instances;
+			list.erase(find(list.begin(), list.end(), instance));
+		}
+		owners.clear();
+
+		const Bounds& b = scene->GetInstance(instance).bounds;
+		int container = -1;
+		for (unsigned int c = 0; c < cells.size(); c++)
+		{
+			if (Contains(cells[c].bounds, b) && (container < 0 || Volume(cells[c].bounds) < Volume(cells[container].bounds)))
+				container = c;
+		}
+
+		for (unsigned int c = 0; c < cells.size(); c++)
+		{
+			if ((int)c == container ||
+				(Overlaps(cells[c].bounds, b) && (container < 0 || Volume(cells[c].bounds) < Volume(cells[container].bounds))))
+			{
+				owners.push_back(c);
+				cells[c].instances.push_back(instance);
+			}
+		}
+	}
+
+	void Visit(unsigned int c, const Frustum& frustum, unsigned int depth)
+	{
+		Cell& cell = cells[c];
+		if (cell.visitedFrame != frame)
+		{
+			cell.visitedFrame = frame;
+			cell.views.clear();
+			reached.push_back(c);
+		}
+		if (cell.views.size() < MAX_VIEWS)
+			cell.views.push_back(frustum);
+		else
+			cell.views.assign(1, viewFrustum);
+
+		if (depth == MAX_DEPTH)
+			return;
+
+		path.push_back(c);
+		for (unsigned int i = 0; i < cell.portals.size(); i++)
+		{
+			const Portal& portal = portals[cell.portals[i]];
+			unsigned int other = portal.cells[0] == c ? portal.cells[1] : portal.cells[0];
+			if (portal.box.empty || find(path.begin(), path.end(), other) != path.end())
+				continue;
+
+			//standing in the opening, the frustum goes through as it is
+			Bounds doorway(portal.box.lowest - glm::vec3(0.3f), portal.box.highest + glm::vec3(0.3f));
+			if (eye.x >= doorway.lowest.x && eye.y >= doorway.lowest.y && eye.z >= doorway.lowest.z &&
+				eye.x <= doorway.highest.x && eye.y <= doorway.highest.y && eye.z <= doorway.highest.z)
+			{
+				Visit(other, frustum, depth + 1);
+				continue;
+			}
+
+			Frustum narrowed;
+			if (Narrow(portal, frustum, narrowed))
+				Visit(other, narrowed, depth + 1);
+		}
+		path.pop_back();
+	}
+
+	//clips the portal quad against the frustum, false when nothing is left.
+	//the narrowed frustum has a plane through the eye and every edge of the clipped quad,
+	//the plane of the portal as its near plane and the far plane of the view
+	bool Narrow(const Portal& portal, const Frustum& frustum, Frustum& narrowed) const
+	{
+		vector<glm::vec3> polygon(portal.corners, portal.corners + 4);
+		vector<glm::vec3> clipped;
+		for (int p = 0; p < frustum.GetPlaneCount() && polygon.size() >= 3; p++)
+		{
+			glm::vec4 plane = frustum.GetPlane(p);
+			clipped.clear();
+			for (unsigned int i = 0; i < polygon.size(); i++)
+			{
+				const glm::vec3& a = polygon[i];
+				const glm::vec3& b = polygon[(i + 1) % polygon.size()];
+				float da = glm::dot(glm::vec3(plane), a) + plane.w;
+				float db = glm::dot(glm::vec3(plane), b) + plane.w;
+				if (da >= 0.0f)
+					clipped.push_back(a);
+				if ((da >= 0.0f) != (db >= 0.0f))
+					clipped.push_back(a + (b - a) * (da / (da - db)));
+			}
+			polygon.swap(clipped);
+		}
+		if (polygon.size() < 3)
+			return false;
+
+		glm::vec3 center(0.0f);
+		for (unsigned int i = 0; i < polygon.size(); i++)
+			center += polygon[i];
+		center /= (float)polygon.size();
+
+		narrowed.ClearPlanes();
+		for (unsigned int i = 0; i < polygon.size(); i++)
+		{
+			glm::vec3 normal = glm::cross(polygon[i] - eye, polygon[(i + 1) % polygon.size()] - eye);
+			float length = glm::length(normal);
+			if (length < 1e-6f)
+				continue;
+			normal /= length;
+			if (glm::dot(normal, center - eye) < 0.0f)
+				normal = -normal;
+			narrowed.AddPlane(normal, -glm::dot(normal, eye));
+		}
+
+		glm::vec3 normal = portal.normal;
+		if (glm::dot(normal, eye - portal.corners[0]) > 0.0f)
+			normal = -normal;
+		narrowed.AddPlane(normal, -glm::dot(normal, portal.corners[0]));
+
+		glm::vec4 farPlane = viewFrustum.GetPlane(5);
+		narrowed.AddPlane(glm::vec3(farPlane), farPlane.w);
+		return true;
+	}
+};
@@ -0,0 +1,967 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Mesh.h"
+#include "Shader.h"
+#include "DrawDataBuffer.h"
+#include "Frustum.h"
+#include "OcclusionTest.h"
+#include "GpuCuller.h"
+#include "ObjectLights.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+using namespace std;
+
+//everything needed to issue one draw call, recorded while the scene graph is traversed
+struct DrawPacket
+{
+	//state and depth packed together, the queue is executed in ascending key order
+	uint64_t key;
+	Shader* shader;
+	Shader* shadowShader;
+	//the mesh holds the material (textures) of the draw
+	const Mesh* mesh;
+	//VAOs of the geometry arena block (shading and position only) and the range of the mesh inside it
+	unsigned int VAO;
+	unsigned int depthVAO;
+	unsigned int firstIndex;
+	unsigned int indexCount;
+	unsigned int baseVertex;
+	glm::mat4 model;
+	//distance from the camera to the center of the world bounds
+	float depth;
+	//scene object the draw belongs to, ~0u when it has none (never occlusion culled)
+	unsigned int object;
+	//drawn blended after all opaque packets
+	bool transparent;
+	//moved recently, goes into the dynamic shadow layer
+	bool dynamic;
+	//distance the object moved this frame
+	float speed;
+};
+
+//consecutive commands that share program, material and VAO, issued together
+struct DrawRun
+{
+	//first packet of the run, supplies the state
+	const DrawPacket* packet;
+	unsigned int firstCommand;
+	unsigned int commandCount;
+};
+
+//the packets drawn by one pass in sorted order, with their own draw records and commands
+struct DrawList
+{
+	vector<unsigned int> packets;
+	//cube faces each packet is drawn to (bit per face), only used by the shadow lists
+	vector<unsigned char> faceMasks;
+	//number of packets drawn to each cube face
+	unsigned int faceCasters[6];
+	unsigned int firstRecord;
+	vector<DrawRun> runs;
+	//shadow lists only, the commands of the per face and the vertex layer paths (see ShadowPath)
+	vector<DrawRun> faceRuns[6];
+	vector<DrawRun> layeredRuns;
+	//runs from here on draw transparent packets, equal to runs.size() when there are none
+	unsigned int firstTransparentRun;
+	//hash of the packets drawn to each face of a shadow list, changes when a caster
+	//enters or leaves the face
+	uint64_t faceSignatures[6];
+	//fastest caster drawn to each face of a shadow list
+	float faceSpeeds[6];
+};
+
+//casters of a shadow view are split in two lists, the static ones can be cached in a map of their own
+enum ShadowLayer
+{
+	SHADOW_STATIC,
+	SHADOW_DYNAMIC,
+	SHADOW_LAYERS
+};
+
+//how the six faces of a shadow cubemap are drawn:
+//geometry: one layered pass, the geometry shader copies each triangle to the faces of its mask.
+//per face: six passes on single face attachments, each with the commands of the casters of that face only.
+//vertex layer: one layered pass with six instances per caster, the vertex shader writes gl_Layer
+//(ARB_shader_viewport_layer_array or AMD_vertex_shader_layer) and drops the faces outside the mask
+enum ShadowPath
+{
+	SHADOW_GEOMETRY,
+	SHADOW_PER_FACE,
+	SHADOW_VERTEX_LAYER,
+	SHADOW_PATHS
+};
+
+//a point light that renders a cube shadow map: only casters inside its range are drawn,
+//and each of them only to the faces whose frustum it touches
+struct ShadowView
+{
+	glm::vec3 position;
+	float range;
+	//projection * view of the six cube faces
+	glm::mat4 faces[6];
+};
+
+//collects the draws of a frame in a flat array, so that the scene graph is walked once
+//and the same packets are replayed for every shadow pass and the main pass.
+//the main pass only draws the packets whose world bounds intersect the view frustum,
+//every shadow view gets a list of the packets inside the range of its light.
+//consecutive packets that draw the same mesh with the same material become one instanced
+//command, every instance reads its matrices from a per draw record. the commands of a run
+//go out with one glMultiDrawElementsIndirect call on GL 4.3, or one
+//glDrawElementsInstancedBaseVertex call each on GL 3.3.
+//on GL 4.3 the main pass can be culled by a compute shader instead (see GpuCuller)
+class RenderQueue
+{
+	vector<DrawPacket> packets;
+	vector<unsigned int> order;
+	glm::vec3 viewPosition;
+	float maxDepth;
+
+	//world bounds of the packets, same indices as packets
+	BoundsSoA bounds;
+	//normal matrix of each packet, computed by the first list that writes a record for it
+	vector<glm::mat3> normalMats;
+	vector<unsigned char> normalReady;
+	//offset of the light list of each packet of the main pass
+	vector<unsigned int> lightLists;
+	vector<unsigned char> visible;
+	Frustum frustum;
+	bool culling;
+	vector<IOcclusionTest*> occlusionTests;
+
+	//per draw records of the sorted packets, written once per frame for every list
+	DrawDataBuffer drawData;
+
+	//commands of the main pass followed by the ones of the shadow passes
+	vector<DrawElementsIndirectCommand> commands;
+	DrawList mainList;
+	vector<ShadowView> shadowViews;
+	//SHADOW_LAYERS lists per view
+	vector<DrawList> shadowLists;
+	vector<unsigned char> faceVisible[6];
+	unsigned int indirectBuffer;
+	unsigned int indirectCapacity;
+	bool multiDraw;
+	//the shadow commands are built for this path
+	ShadowPath shadowPath;
+
+	//main pass culled by a compute shader instead of CullBoxes and the occlusion tests
+	GpuCuller gpuCuller;
+	bool gpuCulling;
+	vector<CullObject> cullObjects;
+	vector<DrawElementsIndirectCommand> cullCommands;
+	vector<CommandRun> cullRuns;
+
+	//light lists of the draws of the main pass, NULL when the shaders do not read them
+	ObjectLights* objectLights;
+
+public:
+	RenderQueue()
+	{
+		viewPosition = glm::vec3(0.0f);
+		maxDepth = 100.0f;
+		culling = true;
+		mainList.firstRecord = 0;
+		mainList.firstTransparentRun = 0;
+		indirectBuffer = 0;
+		indirectCapacity = 0;
+		multiDraw = false;
+		shadowPath = SHADOW_GEOMETRY;
+		gpuCulling = false;
+		objectLights = NULL;
+	}
+
+	//selects glMultiDrawElementsIndirect (GL 4.3 / ARB_multi_draw_indirect) over the 3.3 fallback
+	void SetMultiDraw(bool enable)
+	{
+		multiDraw = enable;
+	}
+
+	bool GetMultiDraw() const
+	{
+		return multiDraw;
+	}
+
+	//the per face and vertex layer paths need commands of their own, built by Sort
+	void SetShadowPath(ShadowPath path)
+	{
+		shadowPath = path;
+	}
+
+	ShadowPath GetShadowPath() const
+	{
+		return shadowPath;
+	}
+
+	//sets up the compute shader culling of the main pass (GL 4.3), multi draw is required too
+	void InitGpuCulling(Shader* cullShader)
+	{
+		gpuCuller.Init(cullShader);
+	}
+
+	void SetGpuCulling(bool enable)
+	{
+		gpuCulling = enable;
+	}
+
+	//true when the main pass is culled on the GPU
+	bool GetGpuCulling() const
+	{
+		return gpuCulling && multiDraw && gpuCuller.IsReady();
+	}
+
+	bool IsGpuCompacting() const
+	{
+		return gpuCuller.IsCompacting();
+	}
+
+	//with culling off the main pass draws every packet
+	void SetCulling(bool enable)
+	{
+		culling = enable;
+	}
+
+	bool GetCulling() const
+	{
+		return culling;
+	}
+
+	//the main pass skips the objects one of the tests reports hidden
+	void AddOcclusionTest(IOcclusionTest* test)
+	{
+		occlusionTests.push_back(test);
+	}
+
+	//every record of the main pass gets the offset of the list of the lights around its bounds
+	void SetObjectLights(ObjectLights* lights)
+	{
+		objectLights = lights;
+	}
+
+	//drops the packets of the previous frame, the storage is kept
+	void Clear()
+	{
+		packets.clear();
+		order.clear();
+		bounds.Clear();
+		shadowViews.clear();
+	}
+
+	//adds a cube shadow map to the frame, the index of the view is passed to ExecuteShadows
+	unsigned int AddShadowView(const ShadowView& shadowView)
+	{
+		shadowViews.push_back(shadowView);
+		return shadowViews.size() - 1;
+	}
+
+	//the camera position and far plane used to compute the depth part of the keys
+	void SetView(const glm::vec3& position, float farPlane)
+	{
+		viewPosition = position;
+		maxDepth = farPlane;
+	}
+
+	//the view frustum the main pass is culled against
+	void SetFrustum(const Frustum& viewFrustum)
+	{
+		frustum = viewFrustum;
+	}
+
+	const glm::vec3& GetViewPosition() const
+	{
+		return viewPosition;
+	}
+
+	unsigned int GetCount() const
+	{
+		return packets.size();
+	}
+
+	//packets that passed the frustum and occlusion tests in the last Sort,
+	//with GPU culling all packets are handed to the compute shader and counted here
+	unsigned int GetVisibleCount() const
+	{
+		return mainList.packets.size();
+	}
+
+	unsigned int GetCulledCount() const
+	{
+		return packets.size() - mainList.packets.size();
+	}
+
+	//packets of all passes skipped in the last Sort because the draw records ran out
+	unsigned int GetDroppedCount() const
+	{
+		return drawData.GetDropped();
+	}
+
+	//packets drawn to a face of a shadow view in the last Sort
+	unsigned int GetShadowCasters(unsigned int view, unsigned int face) const
+	{
+		return shadowLists[view * SHADOW_LAYERS + SHADOW_STATIC].faceCasters[face] +
+			shadowLists[view * SHADOW_LAYERS + SHADOW_DYNAMIC].faceCasters[face];
+	}
+
+	unsigned int GetShadowCasters(unsigned int view, unsigned int face, ShadowLayer layer) const
+	{
+		return shadowLists[view * SHADOW_LAYERS + layer].faceCasters[face];
+	}
+
+	unsigned int GetShadowCasterCount(unsigned int view, ShadowLayer layer) const
+	{
+		return shadowLists[view * SHADOW_LAYERS + layer].packets.size();
+	}
+
+	//compared against the signature the cached face of the layer was drawn with
+	uint64_t GetShadowSignature(unsigned int view, ShadowLayer layer, unsigned int face) const
+	{
+		return shadowLists[view * SHADOW_LAYERS + layer].faceSignatures[face];
+	}
+
+	//distance the fastest caster of a face moved this frame
+	float GetShadowSpeed(unsigned int view, unsigned int face) const
+	{
+		return max(shadowLists[view * SHADOW_LAYERS + SHADOW_STATIC].faceSpeeds[face],
+			shadowLists[view * SHADOW_LAYERS + SHADOW_DYNAMIC].faceSpeeds[face]);
+	}
+
+	//true when something inside the world space box can be drawn by one of the passes of the frame,
+	//used to skip whole subtrees of the scene graph. SetFrustum and AddShadowView come first
+	bool Overlaps(const glm::vec3& boundsMin, const glm::vec3& boundsMax) const
+	{
+		if (!culling || frustum.IsBoxVisible(boundsMin, boundsMax))
+			return true;
+
+		glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+		glm::vec3 extent = (boundsMax - boundsMin) * 0.5f;
+		for (unsigned int i = 0; i < shadowViews.size(); i++)
+		{
+			glm::vec3 offset = glm::max(glm::abs(shadowViews[i].position - center) - extent, glm::vec3(0.0f));
+			if (glm::dot(offset, offset) <= shadowViews[i].range * shadowViews[i].range)
+				return true;
+		}
+		return false;
+	}
+
+	//boundsMin and boundsMax are the world space bounds of the draw, object identifies
+	//the scene object across frames for the occlusion queries
+	void Submit(Shader* shader, Shader* shadowShader, const Mesh& mesh, const glm::mat4& model,
+		const glm::vec3& boundsMin, const glm::vec3& boundsMax, unsigned int object = ~0u, bool dynamic = false, float speed = 0.0f)
+	{
+		if (mesh.IsEmpty())
+			return;
+
+		DrawPacket packet;
+		packet.shader = shader;
+		packet.shadowShader = shadowShader;
+		packet.mesh = &mesh;
+		packet.VAO = mesh.VAO;
+		packet.depthVAO = mesh.depthVAO;
+		packet.firstIndex = mesh.firstIndex;
+		packet.indexCount = mesh.indices.size();
+		packet.baseVertex = mesh.baseVertex;
+		packet.model = model;
+		packet.object = object;
+		packet.transparent = mesh.transparent;
+		packet.dynamic = dynamic;
+		packet.speed = speed;
+		//distance to the center of the bounding sphere of the box
+		packet.depth = glm::length((boundsMin + boundsMax) * 0.5f - viewPosition);
+		packet.key = MakeKey(shader->ID, mesh.materialID, mesh.VAO, mesh.meshID, packet.depth, packet.transparent);
+		packets.push_back(packet);
+		bounds.Add(boundsMin, boundsMax);
+	}
+
+	//orders the packets by key, culls them against the view frustum and the shadow views,
+	//writes the draw records of every list and builds the draw commands of the frame
+	void Sort()
+	{
+		order.resize(packets.size());
+		for (unsigned int i = 0; i < order.size(); i++)
+			order[i] = i;
+
+		std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b)
+		{
+			return packets[a].key < packets[b].key;
+		});
+
+		bool gpu = GetGpuCulling();
+		visible.resize(packets.size());
+		if (culling && !gpu)
+			frustum.CullBoxes(bounds, visible.empty() ? NULL : &visible[0]);
+		else
+			std::fill(visible.begin(), visible.end(), 1);
+
+		mainList.packets.clear();
+		for (unsigned int i = 0; i < order.size(); i++)
+		{
+			unsigned int p = order[i];
+			if (!visible[p])
+				continue;
+			if (!gpu && !IsUnoccluded(p))
+				continue;
+			mainList.packets.push_back(p);
+		}
+
+		shadowLists.resize(shadowViews.size() * SHADOW_LAYERS);
+		unsigned int records = mainList.packets.size();
+		for (unsigned int i = 0; i < shadowViews.size(); i++)
+		{
+			CullShadowView(shadowViews[i], &shadowLists[i * SHADOW_LAYERS]);
+			for (unsigned int layer = 0; layer < SHADOW_LAYERS; layer++)
+				records += shadowLists[i * SHADOW_LAYERS + layer].packets.size();
+		}
+
+		commands.clear();
+		mainList.runs.clear();
+		mainList.firstTransparentRun = 0;
+		for (unsigned int i = 0; i < shadowLists.size(); i++)
+		{
+			shadowLists[i].runs.clear();
+			for (unsigned int face = 0; face < 6; face++)
+				shadowLists[i].faceRuns[face].clear();
+			shadowLists[i].layeredRuns.clear();
+		}
+		if (order.empty())
+			return;
+
+		BuildLightLists();
+		normalMats.resize(packets.size());
+		normalReady.assign(packets.size(), 0);
+
+		drawData.BeginFrame(records);
+		WriteRecords(mainList);
+		for (unsigned int i = 0; i < shadowLists.size(); i++)
+			WriteRecords(shadowLists[i]);
+		drawData.Flush();
+		drawData.Bind();
+
+		BuildCommands(mainList, false);
+		unsigned int mainCommands = commands.size();
+		for (unsigned int i = 0; i < shadowLists.size(); i++)
+		{
+			BuildCommands(shadowLists[i], true);
+			if (shadowPath == SHADOW_PER_FACE)
+				BuildFaceCommands(shadowLists[i]);
+			else if (shadowPath == SHADOW_VERTEX_LAYER)
+				BuildLayeredCommands(shadowLists[i]);
+		}
+		UploadCommands();
+
+		if (gpu)
+			CullOnGpu(mainCommands);
+	}
+
+	//fences the draw records of the frame, call after the last pass
+	void EndFrame()
+	{
+		drawData.EndFrame();
+	}
+
+	void Release()
+	{
+		drawData.Release();
+		gpuCuller.Release();
+		if (indirectBuffer != 0)
+			glDeleteBuffers(1, &indirectBuffer);
+		indirectBuffer = 0;
+	}
+
+	//draws the opaque packets of the main pass front to back with their own shader and material,
+	//the per frame uniforms (camera, lights) must already be set on the shaders. blending stays off.
+	//shader replaces the shader of the packets when it is given (the G-buffer pass of the deferred path)
+	void ExecuteOpaque(const Shader* shader = NULL)
+	{
+		ExecuteRuns(0, mainList.firstTransparentRun, shader);
+	}
+
+	//draws the transparent packets back to front, call after the opaque ones (and the sky)
+	//with blending on and depth writes off
+	void ExecuteTransparent()
+	{
+		ExecuteRuns(mainList.firstTransparentRun, mainList.runs.size());
+	}
+
+	//lays down the depth of the main pass from the position only stream with one depth shader,
+	//the shading pass that follows only runs the fragments that end up visible.
+	//cut outs are drawn with cutoutShader from both streams and their diffuse map, so their clear
+	//texels stay out of the depth buffer
+	void ExecuteDepth(Shader& depthShader, Shader& cutoutShader)
+	{
+		unsigned int VAO = 0;
+		unsigned int program = depthShader.ID;
+		glUseProgram(program);
+
+		//transparent packets do not write depth
+		for (unsigned int i = 0; i < mainList.firstTransparentRun; i++)
+		{
+			const DrawPacket& packet = *mainList.runs[i].packet;
+			const Shader& shader = packet.mesh->cutout ? cutoutShader : depthShader;
+			if (shader.ID != program)
+			{
+				program = shader.ID;
+				glUseProgram(program);
+			}
+			if (packet.mesh->cutout)
+				packet.mesh->BindMaterial(shader);
+
+			unsigned int packetVAO = packet.mesh->cutout ? packet.VAO : packet.depthVAO;
+			if (packetVAO != VAO)
+			{
+				VAO = packetVAO;
+				glBindVertexArray(VAO);
+			}
+
+			if (GetGpuCulling())
+				gpuCuller.Draw(i, mainList.runs[i].firstCommand, mainList.runs[i].commandCount, false);
+			else
+				DrawCommands(mainList.runs[i]);
+		}
+		glBindVertexArray(0);
+	}
+
+	//draws the casters of a shadow view with their shadow shader from the position only stream,
+	//materials are not needed for the depth only passes. shader replaces the shadow shader
+	//of the packets when it is given
+	void ExecuteShadows(unsigned int view, ShadowLayer layer, const Shader* shader = NULL)
+	{
+		ExecuteShadowRuns(shadowLists[view * SHADOW_LAYERS + layer].runs, shader, 1);
+	}
+
+	//draws the casters of one cube face, the per face shadow path must have been set before Sort
+	void ExecuteShadowFace(unsigned int view, ShadowLayer layer, unsigned int face, const Shader* shader = NULL)
+	{
+		ExecuteShadowRuns(shadowLists[view * SHADOW_LAYERS + layer].faceRuns[face], shader, 1);
+	}
+
+	//draws every caster six times, once per face, the vertex layer shadow path must have been set before Sort
+	void ExecuteShadowsLayered(unsigned int view, ShadowLayer layer, const Shader* shader = NULL)
+	{
+		ExecuteShadowRuns(shadowLists[view * SHADOW_LAYERS + layer].layeredRuns, shader, 6);
+	}
+
+private:
+	//64 bit key, from the most significant bits:
+	//opaque: layer 0 (1) | program (8) | material (14) | arena block VAO (4) | mesh (14) | depth (23)
+	//so that state changes are minimized, instances of a mesh end up next to each other
+	//and draws with the same state go front to back.
+	//transparent: layer 1 (1) | inverted depth (23) | program (8) | material (14) | VAO (4) | mesh (14)
+	//so that they come after all opaque draws, strictly back to front
+	uint64_t MakeKey(unsigned int program, unsigned int material, unsigned int VAO, unsigned int mesh, float depth, bool transparent) const
+	{
+		float d = depth / maxDepth;
+		d = d < 0.0f ? 0.0f : d;
+		d = d > 1.0f ? 1.0f : d;
+		uint64_t depthBits = (uint64_t)(d * 0x7FFFFF);
+
+		uint64_t state = ((uint64_t)(program & 0xFF) << 32) |
+			((uint64_t)(material & 0x3FFF) << 18) |
+			((uint64_t)(VAO & 0xF) << 14) |
+			(uint64_t)(mesh & 0x3FFF);
+
+		if (transparent)
+			return (1ull << 63) | ((0x7FFFFF - depthBits) << 40) | state;
+		return (state << 23) | depthBits;
+	}
+
+	bool SameState(const DrawPacket& a, const DrawPacket& b, bool shadows) const
+	{
+		if (shadows)
+			return a.shadowShader->ID == b.shadowShader->ID && a.depthVAO == b.depthVAO;
+		return a.shader->ID == b.shader->ID && a.mesh->materialID == b.mesh->materialID && a.VAO == b.VAO &&
+			a.transparent == b.transparent;
+	}
+
+	//the light lists of the packets of the main pass, one per scene object
+	void BuildLightLists()
+	{
+		lightLists.assign(packets.size(), 0);
+		if (objectLights == NULL)
+			return;
+
+		objectLights->Begin();
+		for (unsigned int i = 0; i < mainList.packets.size(); i++)
+		{
+			unsigned int p = mainList.packets[i];
+			lightLists[p] = objectLights->Build(packets[p].object, glm::vec3(bounds.centerX[p], bounds.centerY[p], bounds.centerZ[p]),
+				glm::vec3(bounds.extentX[p], bounds.extentY[p], bounds.extentZ[p]));
+		}
+		objectLights->End();
+	}
+
+	//writes the draw records of a list in its order
+	void WriteRecords(DrawList& list)
+	{
+		if (list.packets.empty())
+			return;
+
+		//the packets without a record are not drawn this frame, the ring grows by them in the next one
+		unsigned int reserved = list.packets.size();
+		DrawRecord* records = drawData.Allocate(reserved, list.firstRecord);
+		list.packets.resize(reserved);
+		if (!list.faceMasks.empty())
+			list.faceMasks.resize(reserved);
+		for (unsigned int i = 0; i < reserved; i++)
+		{
+			unsigned int p = list.packets[i];
+			const DrawPacket& packet = packets[p];
+			if (!normalReady[p])
+			{
+				normalMats[p] = glm::transpose(glm::inverse(glm::mat3(packet.model)));
+				normalReady[p] = 1;
+			}
+			const glm::mat3& normalMat = normalMats[p];
+			records[i].model = packet.model;
+			records[i].normalMat[0] = glm::vec4(normalMat[0], (float)packet.mesh->materialID);
+			//the geometry shader of the cube shadow passes skips the faces that are not in the mask
+			float faceMask = list.faceMasks.empty() ? 63.0f : (float)list.faceMasks[i];
+			records[i].normalMat[1] = glm::vec4(normalMat[1], faceMask);
+			//the fragment shader of the main pass finds the lights of the draw at this offset
+			records[i].normalMat[2] = glm::vec4(normalMat[2], (float)lightLists[p]);
+		}
+	}
+
+	bool IsUnoccluded(unsigned int p)
+	{
+		if (occlusionTests.empty())
+			return true;
+
+		glm::vec3 center(bounds.centerX[p], bounds.centerY[p], bounds.centerZ[p]);
+		glm::vec3 extent(bounds.extentX[p], bounds.extentY[p], bounds.extentZ[p]);
+		for (unsigned int i = 0; i < occlusionTests.size(); i++)
+		{
+			if (!occlusionTests[i]->IsVisible(packets[p].object, center - extent, center + extent, viewPosition))
+				return false;
+		}
+		return true;
+	}
+
+	//collects the packets within the range of the light that touch at least one face frustum
+	//fills the SHADOW_LAYERS lists of a view, packets of recently moved objects go into the dynamic one
+	void CullShadowView(const ShadowView& shadowView, DrawList* lists)
+	{
+		for (unsigned int face = 0; face < 6; face++)
+		{
+			faceVisible[face].resize(packets.size());
+			if (!packets.empty())
+				Frustum(shadowView.faces[face]).CullBoxes(bounds, &faceVisible[face][0]);
+		}
+		for (unsigned int layer = 0; layer < SHADOW_LAYERS; layer++)
+		{
+			for (unsigned int face = 0; face < 6; face++)
+			{
+				lists[layer].faceCasters[face] = 0;
+				//FNV-1a offset basis
+				lists[layer].faceSignatures[face] = 14695981039346656037ull;
+				lists[layer].faceSpeeds[face] = 0.0f;
+			}
+			lists[layer].packets.clear();
+			lists[layer].faceMasks.clear();
+		}
+
+		float rangeSqr = shadowView.range * shadowView.range;
+		for (unsigned int i = 0; i < order.size(); i++)
+		{
+			unsigned int p = order[i];
+			//squared distance from the light to the closest point of the box
+			glm::vec3 center(bounds.centerX[p], bounds.centerY[p], bounds.centerZ[p]);
+			glm::vec3 extent(bounds.extentX[p], bounds.extentY[p], bounds.extentZ[p]);
+			glm::vec3 offset = glm::abs(shadowView.position - center) - extent;
+			offset = glm::max(offset, glm::vec3(0.0f));
+			if (glm::dot(offset, offset) > rangeSqr)
+				continue;
+
+			DrawList& list = lists[packets[p].dynamic ? SHADOW_DYNAMIC : SHADOW_STATIC];
+			unsigned char mask = 0;
+			for (unsigned int face = 0; face < 6; face++)
+			{
+				if (faceVisible[face][p])
+				{
+					mask |= 1 << face;
+					list.faceCasters[face]++;
+					list.faceSpeeds[face] = max(list.faceSpeeds[face], packets[p].speed);
+					HashShadowCaster(list.faceSignatures[face], packets[p].object, packets[p].mesh->meshID);
+				}
+			}
+			if (mask == 0)
+				continue;
+
+			list.packets.push_back(p);
+			list.faceMasks.push_back(mask);
+		}
+	}
+
+	//static casters only change a face by entering or leaving it, their transforms are
+	//fixed as long as they stay out of the dynamic layer
+	static void HashShadowCaster(uint64_t& signature, unsigned int object, unsigned int meshID)
+	{
+		unsigned int values[2] = { object, meshID };
+		const unsigned char* bytes = (const unsigned char*)values;
+		for (unsigned int i = 0; i < sizeof(values); i++)
+		{
+			signature ^= bytes[i];
+			signature *= 1099511628211ull;
+		}
+	}
+
+	//hands the bounds and the first mainCommands commands (those of the main list) to the compute shader.
+	//every command gets its instances again from the culling, starting at the draw id slot
+	//of its first packet
+	void CullOnGpu(unsigned int mainCommands)
+	{
+		cullObjects.resize(mainList.packets.size());
+		cullCommands.assign(commands.begin(), commands.begin() + mainCommands);
+		cullRuns.resize(mainCommands);
+		for (unsigned int r = 0; r < mainList.runs.size(); r++)
+		{
+			const DrawRun& run = mainList.runs[r];
+			for (unsigned int c = run.firstCommand; c < run.firstCommand + run.commandCount; c++)
+			{
+				DrawElementsIndirectCommand& command = cullCommands[c];
+				unsigned int first = command.baseInstance - mainList.firstRecord;
+				for (unsigned int i = first; i < first + command.instanceCount; i++)
+				{
+					unsigned int p = mainList.packets[i];
+					cullObjects[i].center = glm::vec3(bounds.centerX[p], bounds.centerY[p], bounds.centerZ[p]);
+					cullObjects[i].extent = glm::vec3(bounds.extentX[p], bounds.extentY[p], bounds.extentZ[p]);
+					cullObjects[i].command = c;
+					cullObjects[i].padding = 0;
+				}
+				command.instanceCount = 0;
+				command.baseInstance = first;
+				cullRuns[c].run = r;
+				cullRuns[c].firstCommand = run.firstCommand;
+			}
+		}
+		gpuCuller.Cull(culling ? &frustum : NULL, cullObjects, mainList.firstRecord, cullCommands, cullRuns, mainList.runs.size());
+	}
+
+	//number of packets of the list starting at first that can go out as one instanced command
+	unsigned int BatchSize(const DrawList& list, unsigned int first, bool shadows) const
+	{
+		const DrawPacket& a = packets[list.packets[first]];
+		unsigned int count = 1;
+		while (first + count < list.packets.size())
+		{
+			const DrawPacket& b = packets[list.packets[first + count]];
+			if (!SameState(a, b, shadows) || a.mesh->meshID != b.mesh->meshID)
+				break;
+			count++;
+		}
+		return count;
+	}
+
+	//turns the packets of a list into instanced commands, grouped into runs of equal state
+	void BuildCommands(DrawList& list, bool shadows)
+	{
+		vector<DrawRun>& runs = list.runs;
+		unsigned int i = 0;
+		while (i < list.packets.size())
+		{
+			const DrawPacket& packet = packets[list.packets[i]];
+			unsigned int count = BatchSize(list, i, shadows);
+
+			if (runs.empty() || !SameState(*runs.back().packet, packet, shadows))
+			{
+				DrawRun run;
+				run.packet = &packet;
+				run.firstCommand = commands.size();
+				run.commandCount = 0;
+				runs.push_back(run);
+			}
+
+			DrawElementsIndirectCommand command;
+			command.count = packet.indexCount;
+			command.instanceCount = count;
+			command.firstIndex = packet.firstIndex;
+			command.baseVertex = packet.baseVertex;
+			command.baseInstance = list.firstRecord + i;
+			commands.push_back(command);
+			runs.back().commandCount++;
+
+			i += count;
+		}
+
+		list.firstTransparentRun = runs.size();
+		for (unsigned int r = 0; r < runs.size(); r++)
+		{
+			if (runs[r].packet->transparent)
+			{
+				list.firstTransparentRun = r;
+				break;
+			}
+		}
+	}
+
+	//splits the commands of a shadow list by cube face, the instances of a command that
+	//do not touch the face break it into several commands
+	void BuildFaceCommands(DrawList& list)
+	{
+		for (unsigned int face = 0; face < 6; face++)
+		{
+			for (unsigned int r = 0; r < list.runs.size(); r++)
+			{
+				DrawRun run = list.runs[r];
+				run.firstCommand = commands.size();
+				run.commandCount = 0;
+
+				for (unsigned int c = list.runs[r].firstCommand; c < list.runs[r].firstCommand + list.runs[r].commandCount; c++)
+				{
+					DrawElementsIndirectCommand command = commands[c];
+					unsigned int first = command.baseInstance - list.firstRecord;
+					unsigned int end = first + command.instanceCount;
+					unsigned int i = first;
+					while (i < end)
+					{
+						if (!(list.faceMasks[i] & (1 << face)))
+						{
+							i++;
+							continue;
+						}
+						unsigned int start = i;
+						while (i < end && (list.faceMasks[i] & (1 << face)))
+							i++;
+
+						command.baseInstance = list.firstRecord + start;
+						command.instanceCount = i - start;
+						commands.push_back(command);
+						run.commandCount++;
+					}
+				}
+
+				if (run.commandCount > 0)
+					list.faceRuns[face].push_back(run);
+			}
+		}
+	}
+
+	//copies of the commands of a shadow list with six instances per record
+	void BuildLayeredCommands(DrawList& list)
+	{
+		for (unsigned int r = 0; r < list.runs.size(); r++)
+		{
+			DrawRun run = list.runs[r];
+			run.firstCommand = commands.size();
+			for (unsigned int c = list.runs[r].firstCommand; c < list.runs[r].firstCommand + list.runs[r].commandCount; c++)
+			{
+				DrawElementsIndirectCommand command = commands[c];
+				command.instanceCount *= 6;
+				commands.push_back(command);
+			}
+			list.layeredRuns.push_back(run);
+		}
+	}
+
+	//divisor is the number of instances that read the same draw record
+	void ExecuteShadowRuns(const vector<DrawRun>& runs, const Shader* shader, unsigned int divisor)
+	{
+		unsigned int program = 0;
+		unsigned int VAO = 0;
+
+		for (unsigned int i = 0; i < runs.size(); i++)
+		{
+			const DrawPacket& packet = *runs[i].packet;
+			const Shader* runShader = shader != NULL ? shader : packet.shadowShader;
+
+			if (runShader->ID != program)
+			{
+				program = runShader->ID;
+				glUseProgram(program);
+			}
+			if (packet.depthVAO != VAO)
+			{
+				VAO = packet.depthVAO;
+				glBindVertexArray(VAO);
+			}
+
+			DrawCommands(runs[i], divisor);
+		}
+		glBindVertexArray(0);
+	}
+
+	//draws the runs [first, last) of the main list
+	void ExecuteRuns(unsigned int first, unsigned int last, const Shader* replacement = NULL)
+	{
+		unsigned int program = 0;
+		const Shader* shader = NULL;
+		unsigned int material = ~0u;
+		unsigned int VAO = 0;
+
+		for (unsigned int i = first; i < last; i++)
+		{
+			const DrawPacket& packet = *mainList.runs[i].packet;
+
+			const Shader* packetShader = replacement != NULL ? replacement : packet.shader;
+			if (packetShader->ID != program)
+			{
+				shader = packetShader;
+				program = shader->ID;
+				glUseProgram(program);
+				material = ~0u;
+			}
+			if (packet.mesh->materialID != material)
+			{
+				material = packet.mesh->materialID;
+				packet.mesh->BindMaterial(*shader);
+			}
+			if (packet.VAO != VAO)
+			{
+				VAO = packet.VAO;
+				glBindVertexArray(VAO);
+			}
+
+			//the compaction would lose the back to front order of the transparent commands
+			if (GetGpuCulling())
+				gpuCuller.Draw(i, mainList.runs[i].firstCommand, mainList.runs[i].commandCount, packet.transparent);
+			else
+				DrawCommands(mainList.runs[i]);
+		}
+		glBindVertexArray(0);
+	}
+
+	void UploadCommands()
+	{
+		if (!multiDraw || commands.empty())
+			return;
+
+		if (indirectBuffer == 0)
+			glGenBuffers(1, &indirectBuffer);
+
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+		if (commands.size() > indirectCapacity)
+			indirectCapacity = commands.size() * 2;
+		//orphan the commands of the previous frame, then fill the new storage
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, indirectCapacity * sizeof(DrawElementsIndirectCommand), NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), &commands[0]);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+
+	//issues the commands of a run on the bound VAO
+	void DrawCommands(const DrawRun& run, unsigned int divisor = 1)
+	{
+		if (multiDraw)
+		{
+			//the base instance of each command offsets the draw index attribute
+			drawData.BindDrawID(0, divisor);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+				(void*)(run.firstCommand * sizeof(DrawElementsIndirectCommand)), run.commandCount, 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			return;
+		}
+
+		//without base instance support the attribute offset selects the first record
+		for (unsigned int c = run.firstCommand; c < run.firstCommand + run.commandCount; c++)
+		{
+			const DrawElementsIndirectCommand& command = commands[c];
+			drawData.BindDrawID(command.baseInstance, divisor);
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+				(void*)(command.firstIndex * sizeof(unsigned int)), command.instanceCount, command.baseVertex);
+		}
+	}
+};
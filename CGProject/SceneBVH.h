@@ -0,0 +1,487 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "GeometryNode.h"
+#include "TransformNode.h"
+#include "GroupNode.h"
+#include "BoundingObjects.h"
+#include "Frustum.h"
+#include "RenderQueue.h"
+#include "SoftwareOcclusion.h"
+#include "ObjectLights.h"
+
+#include <vector>
+#include <map>
+#include <algorithm>
+using namespace std;
+
+//a geometry node reached through one path of the scene graph. shared geometry nodes
+//(the walls, the windows) give one instance per path
+struct SceneInstance
+{
+	GeometryNode* node;
+	//the group and transform nodes from the root down to the geometry node
+	vector<Node*> path;
+	glm::mat4 transform;
+	//world space box of the model
+	Bounds bounds;
+};
+
+//bounding volume hierarchy over the world space boxes of all instances, built with the
+//binned surface area heuristic. moving a TransformNode only refits the boxes above the
+//instances below it, the tree itself is kept until Build is called again.
+//rendering, picking and camera collisions all go through its queries
+class SceneBVH
+{
+	struct BVHNode
+	{
+		Bounds bounds;
+		int parent;
+		//children for inner nodes, -1 for leaves
+		int left, right;
+		//range in items for leaves
+		unsigned int first, count;
+	};
+
+	static const unsigned int BINS = 12;
+	static const unsigned int LEAF_SIZE = 2;
+	//an instance counts as dynamic for this many frames after it moved
+	static const unsigned int DYNAMIC_FRAMES = 60;
+
+	vector<SceneInstance> instances;
+	vector<BVHNode> nodes;
+	//instance indices, leaves point into it
+	vector<unsigned int> items;
+	//leaf of every instance
+	vector<int> leafOf;
+	//instances below each transform node, refit when it moves
+	map<Node*, vector<unsigned int> > dependents;
+	vector<TransformNode*> moved;
+	//instances updated by the last Refit
+	vector<unsigned int> refitted;
+	//Refit calls so far, and the last one that moved each instance (0 never)
+	unsigned int frame;
+	vector<unsigned int> movedFrame;
+	//distance the center of each instance moved in the Refit of movedFrame
+	vector<float> speed;
+	//query results, kept to reuse the storage
+	vector<unsigned int> candidates;
+
+public:
+	SceneBVH()
+	{
+		frame = 1;
+	}
+
+	//collects the instances of the graph and builds the tree from scratch,
+	//needed again when nodes are added to the graph
+	void Build(GroupNode* root)
+	{
+		instances.clear();
+		dependents.clear();
+		refitted.clear();
+		vector<Node*> path;
+		Collect(root, glm::mat4(1.0f), path);
+		TransformNode::TakeMoved(moved);
+
+		nodes.clear();
+		items.resize(instances.size());
+		for (unsigned int i = 0; i < items.size(); i++)
+			items[i] = i;
+		leafOf.assign(instances.size(), -1);
+		movedFrame.assign(instances.size(), 0);
+		speed.assign(instances.size(), 0.0f);
+		if (!instances.empty())
+			Subdivide(-1, 0, items.size());
+	}
+
+	//updates the instances below the transform nodes that changed since the last call
+	//and the boxes of the tree nodes above them
+	void Refit()
+	{
+		TransformNode::TakeMoved(moved);
+		refitted.clear();
+		frame++;
+		for (unsigned int m = 0; m < moved.size(); m++)
+		{
+			map<Node*, vector<unsigned int> >::iterator it = dependents.find(moved[m]);
+			if (it == dependents.end())
+				continue;
+
+			for (unsigned int i = 0; i < it->second.size(); i++)
+			{
+				unsigned int index = it->second[i];
+				SceneInstance& instance = instances[index];
+				glm::vec3 before = (instance.bounds.lowest + instance.bounds.highest) * 0.5f;
+				instance.transform = PathTransform(instance.path);
+				instance.bounds = instance.node->GetBounds().Transformed(instance.transform);
+				RefitFrom(leafOf[index]);
+				refitted.push_back(index);
+
+				//an instance below several moved nodes is updated more than once, the first update has the distance
+				float distance = glm::length((instance.bounds.lowest + instance.bounds.highest) * 0.5f - before);
+				speed[index] = movedFrame[index] == frame ? max(speed[index], distance) : distance;
+				movedFrame[index] = frame;
+			}
+		}
+		moved.clear();
+	}
+
+	unsigned int GetInstanceCount() const
+	{
+		return instances.size();
+	}
+
+	const SceneInstance& GetInstance(unsigned int i) const
+	{
+		return instances[i];
+	}
+
+	//true for the instances that moved during the last DYNAMIC_FRAMES calls to Refit
+	bool IsDynamic(unsigned int i) const
+	{
+		return movedFrame[i] != 0 && frame - movedFrame[i] < DYNAMIC_FRAMES;
+	}
+
+	//distance the instance moved in the last Refit, 0 when it did not move
+	float GetSpeed(unsigned int i) const
+	{
+		return movedFrame[i] == frame ? speed[i] : 0.0f;
+	}
+
+	//instances moved by the last Refit, an instance is listed once per moved node above it
+	const vector<unsigned int>& GetRefitted() const
+	{
+		return refitted;
+	}
+
+	//appends the instances whose box passes the test, test gets the box of every visited tree node
+	template<class Test>
+	void Query(Test test, vector<unsigned int>& result) const
+	{
+		if (nodes.empty())
+			return;
+
+		vector<int> stack;
+		stack.push_back(0);
+		while (!stack.empty())
+		{
+			const BVHNode& node = nodes[stack.back()];
+			stack.pop_back();
+			if (!test(node.bounds))
+				continue;
+
+			if (node.left < 0)
+			{
+				for (unsigned int i = node.first; i < node.first + node.count; i++)
+				{
+					if (test(instances[items[i]].bounds))
+						result.push_back(items[i]);
+				}
+				continue;
+			}
+			stack.push_back(node.left);
+			stack.push_back(node.right);
+		}
+	}
+
+	void QueryBox(const Bounds& box, vector<unsigned int>& result) const
+	{
+		Query([&box](const Bounds& b)
+		{
+			return !(b.highest.x < box.lowest.x || b.lowest.x > box.highest.x ||
+				b.highest.y < box.lowest.y || b.lowest.y > box.highest.y ||
+				b.highest.z < box.lowest.z || b.lowest.z > box.highest.z);
+		}, result);
+	}
+
+	void QuerySphere(const glm::vec3& center, float radius, vector<unsigned int>& result) const
+	{
+		Query([&center, radius](const Bounds& b)
+		{
+			glm::vec3 offset = center - glm::clamp(center, b.lowest, b.highest);
+			return glm::dot(offset, offset) <= radius * radius;
+		}, result);
+	}
+
+	void QueryRay(const glm::vec3& rayOrigin, const glm::vec3& rayDirection, vector<unsigned int>& result) const
+	{
+		Query([&rayOrigin, &rayDirection](const Bounds& b)
+		{
+			return b.IntersectsRay(rayOrigin, rayDirection);
+		}, result);
+	}
+
+	void QueryFrustum(const Frustum& frustum, vector<unsigned int>& result) const
+	{
+		Query([&frustum](const Bounds& b)
+		{
+			return frustum.IsBoxVisible(b.lowest, b.highest);
+		}, result);
+	}
+
+	//submits the instances that can be drawn by one of the passes of the frame
+	//(view frustum or the range of a shadow casting light)
+	void Submit(RenderQueue& queue)
+	{
+		candidates.clear();
+		Query([&queue](const Bounds& b)
+		{
+			return queue.Overlaps(b.lowest, b.highest);
+		}, candidates);
+
+		for (unsigned int i = 0; i < candidates.size(); i++)
+		{
+			const SceneInstance& instance = instances[candidates[i]];
+			instance.node->Submit(queue, instance.transform, instance.bounds, candidates[i],
+				IsDynamic(candidates[i]), GetSpeed(candidates[i]));
+		}
+	}
+
+	//hands the lights the instances their range reaches, the instance index is the object of the draws
+	void SubmitLights(ObjectLights& lights)
+	{
+		lights.BeginAssign(instances.size());
+		for (unsigned int l = 0; l < lights.GetLampCount(); l++)
+		{
+			const glm::vec4& lamp = lights.GetLamp(l);
+			if (lamp.w <= 0.0f)
+				continue;
+			candidates.clear();
+			QuerySphere(glm::vec3(lamp), lamp.w, candidates);
+			for (unsigned int i = 0; i < candidates.size(); i++)
+				lights.AddLamp(candidates[i], l);
+		}
+		for (unsigned int l = 0; l < lights.GetLightCount(); l++)
+		{
+			candidates.clear();
+			QuerySphere(lights.GetLight(l).position, lights.GetLight(l).range, candidates);
+			for (unsigned int i = 0; i < candidates.size(); i++)
+				lights.AddLight(candidates[i], l);
+		}
+		lights.EndAssign();
+	}
+
+	//hands the meshes of the occluders inside the frustum to the software occlusion culling
+	void SubmitOccluders(SoftwareOcclusion& culler, const Frustum& frustum)
+	{
+		candidates.clear();
+		QueryFrustum(frustum, candidates);
+		for (unsigned int i = 0; i < candidates.size(); i++)
+		{
+			const SceneInstance& instance = instances[candidates[i]];
+			if (!instance.node->IsOccluder())
+				continue;
+
+			const Model& model = instance.node->GetModel();
+			for (unsigned int m = 0; m < model.meshes.size(); m++)
+				culler.AddOccluder(model.meshes[m], instance.transform);
+		}
+	}
+
+	//ray hits of the bounding spheres of the instances along the ray
+	void Intersections(const glm::vec3& rayOrigin, const glm::vec3& rayDirection, vector<Intersection*>& hits)
+	{
+		candidates.clear();
+		QueryRay(rayOrigin, rayDirection, candidates);
+		for (unsigned int i = 0; i < candidates.size(); i++)
+		{
+			const SceneInstance& instance = instances[candidates[i]];
+			Intersection* hit = new Intersection();
+			if (instance.node->Intersects(instance.transform, rayOrigin, rayDirection, *hit))
+			{
+				hit->path = instance.path;
+				hits.push_back(hit);
+			}
+			else
+			{
+				delete hit;
+			}
+		}
+	}
+
+	//swept player collisions with the boxes of the instances near the swept player box
+	void Collisions(BoundingBox& player, const glm::vec3& velocity, vector<collision*>& collisions)
+	{
+		Bounds swept(min(player.getMin(), player.getMin() + velocity), max(player.getMax(), player.getMax() + velocity));
+		candidates.clear();
+		QueryBox(swept, candidates);
+		for (unsigned int i = 0; i < candidates.size(); i++)
+		{
+			const SceneInstance& instance = instances[candidates[i]];
+			instance.node->Collides(instance.transform, player, velocity, collisions);
+		}
+	}
+
+private:
+	void Collect(Node* node, const glm::mat4& transform, vector<Node*>& path)
+	{
+		if (node->GetType() == nt_GeometryNode)
+		{
+			SceneInstance instance;
+			instance.node = (GeometryNode*)node;
+			instance.path = path;
+			instance.transform = transform;
+			instance.bounds = instance.node->GetBounds().Transformed(transform);
+			for (unsigned int i = 0; i < path.size(); i++)
+			{
+				if (path[i]->GetType() == nt_TransformNode)
+					dependents[path[i]].push_back(instances.size());
+			}
+			instances.push_back(instance);
+			return;
+		}
+
+		GroupNode* group = (GroupNode*)node;
+		glm::mat4 childTransform = transform;
+		if (node->GetType() == nt_TransformNode)
+			childTransform = transform * ((TransformNode*)node)->GetLocalMatrix();
+
+		path.push_back(node);
+		for (unsigned int i = 0; i < group->GetChildCount(); i++)
+			Collect(group->GetChild(i), childTransform, path);
+		path.pop_back();
+	}
+
+	static glm::mat4 PathTransform(const vector<Node*>& path)
+	{
+		glm::mat4 transform(1.0f);
+		for (unsigned int i = 0; i < path.size(); i++)
+		{
+			if (path[i]->GetType() == nt_TransformNode)
+				transform = transform * ((TransformNode*)path[i])->GetLocalMatrix();
+		}
+		return transform;
+	}
+
+	float Area(const Bounds& b) const
+	{
+		if (b.empty)
+			return 0.0f;
+		glm::vec3 d = b.highest - b.lowest;
+		return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	//creates the node for items[first, first + count) and returns its index
+	int Subdivide(int parent, unsigned int first, unsigned int count)
+	{
+		BVHNode node;
+		node.parent = parent;
+		node.left = node.right = -1;
+		node.first = first;
+		node.count = count;
+		Bounds centroids;
+		for (unsigned int i = first; i < first + count; i++)
+		{
+			node.bounds.Add(instances[items[i]].bounds);
+			centroids.Add((instances[items[i]].bounds.lowest + instances[items[i]].bounds.highest) * 0.5f);
+		}
+		int index = nodes.size();
+		nodes.push_back(node);
+
+		int axis = -1;
+		unsigned int split = 0;
+		if (count > LEAF_SIZE)
+			axis = FindSplit(first, count, centroids, split);
+
+		if (axis < 0)
+		{
+			for (unsigned int i = first; i < first + count; i++)
+				leafOf[items[i]] = index;
+			return index;
+		}
+
+		//partition around the chosen bin boundary
+		float extent = centroids.highest[axis] - centroids.lowest[axis];
+		unsigned int* begin = &items[first];
+		unsigned int* middle = std::partition(begin, begin + count, [&](unsigned int item)
+		{
+			float c = (instances[item].bounds.lowest[axis] + instances[item].bounds.highest[axis]) * 0.5f;
+			unsigned int bin = min((unsigned int)((c - centroids.lowest[axis]) / extent * BINS), BINS - 1);
+			return bin < split;
+		});
+		unsigned int leftCount = middle - begin;
+		if (leftCount == 0 || leftCount == count)
+			leftCount = count / 2;
+
+		int left = Subdivide(index, first, leftCount);
+		int right = Subdivide(index, first + leftCount, count - leftCount);
+		nodes[index].left = left;
+		nodes[index].right = right;
+		return index;
+	}
+
+	//binned SAH over the centroids, returns the axis (or -1 when a leaf is cheaper) and the first bin of the right side
+	int FindSplit(unsigned int first, unsigned int count, const Bounds& centroids, unsigned int& split) const
+	{
+		float bestCost = Area(nodes.back().bounds) * count;
+		int bestAxis = -1;
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float extent = centroids.highest[axis] - centroids.lowest[axis];
+			if (extent <= 0.0f)
+				continue;
+
+			Bounds binBounds[BINS];
+			unsigned int binCount[BINS] = {};
+			for (unsigned int i = first; i < first + count; i++)
+			{
+				const Bounds& b = instances[items[i]].bounds;
+				float c = (b.lowest[axis] + b.highest[axis]) * 0.5f;
+				unsigned int bin = min((unsigned int)((c - centroids.lowest[axis]) / extent * BINS), BINS - 1);
+				binBounds[bin].Add(b);
+				binCount[bin]++;
+			}
+
+			for (unsigned int s = 1; s < BINS; s++)
+			{
+				Bounds left, right;
+				unsigned int leftCount = 0, rightCount = 0;
+				for (unsigned int b = 0; b < s; b++)
+				{
+					left.Add(binBounds[b]);
+					leftCount += binCount[b];
+				}
+				for (unsigned int b = s; b < BINS; b++)
+				{
+					right.Add(binBounds[b]);
+					rightCount += binCount[b];
+				}
+				if (leftCount == 0 || rightCount == 0)
+					continue;
+
+				float cost = Area(left) * leftCount + Area(right) * rightCount;
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					bestAxis = axis;
+					split = s;
+				}
+			}
+		}
+		return bestAxis;
+	}
+
+	//recomputes the boxes from a leaf up to the root
+	void RefitFrom(int index)
+	{
+		while (index >= 0)
+		{
+			BVHNode& node = nodes[index];
+			node.bounds = Bounds();
+			if (node.left < 0)
+			{
+				for (unsigned int i = node.first; i < node.first + node.count; i++)
+					node.bounds.Add(instances[items[i]].bounds);
+			}
+			else
+			{
+				node.bounds.Add(nodes[node.left].bounds);
+				node.bounds.Add(nodes[node.right].bounds);
+			}
+			index = node.parent;
+		}
+	}
+};
\ No newline at end of file
@@ -21,7 +21,9 @@ public:
 		ID = 0;
 	}
 
-	void Load(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr)
+	// defines (optional) are inserted after the #version line of every stage, so one file can be
+	// compiled in several variants
+	void Load(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr, const char* defines = nullptr)
 	{
 		// 1. retrieve the vertex/fragment source code from filePath
 		std::string vertexCode;
@@ -63,6 +65,12 @@ public:
 		{
 			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
 		}
+		if (defines != nullptr)
+		{
+			insertDefines(vertexCode, defines);
+			insertDefines(fragmentCode, defines);
+			insertDefines(geometryCode, defines);
+		}
 		const char* vShaderCode = vertexCode.c_str();
 		const char * fShaderCode = fragmentCode.c_str();
 		// 2. compile shaders
@@ -105,6 +113,37 @@ public:
 
 	}
 
+	// compute shader program (GL 4.3 / ARB_compute_shader)
+	// ------------------------------------------------------------------------
+	void LoadCompute(const char* computePath)
+	{
+		std::string computeCode;
+		std::ifstream cShaderFile;
+		cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+		try
+		{
+			cShaderFile.open(computePath);
+			std::stringstream cShaderStream;
+			cShaderStream << cShaderFile.rdbuf();
+			cShaderFile.close();
+			computeCode = cShaderStream.str();
+		}
+		catch (std::ifstream::failure e)
+		{
+			std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+		}
+		const char* cShaderCode = computeCode.c_str();
+		unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(compute, 1, &cShaderCode, NULL);
+		glCompileShader(compute);
+		checkCompileErrors(compute, "COMPUTE");
+		ID = glCreateProgram();
+		glAttachShader(ID, compute);
+		glLinkProgram(ID);
+		checkCompileErrors(ID, "PROGRAM");
+		glDeleteShader(compute);
+	}
+
 	// activate the shader
 	// ------------------------------------------------------------------------
 	void use()
@@ -171,6 +210,17 @@ public:
 	}
 
 private:
+	// puts the defines on the line after #version, which has to stay the first line
+	// ------------------------------------------------------------------------
+	static void insertDefines(std::string& code, const char* defines)
+	{
+		if (code.empty())
+			return;
+		size_t line = code.compare(0, 8, "#version") == 0 ? code.find('\n') : std::string::npos;
+		size_t at = line == std::string::npos ? 0 : line + 1;
+		code.insert(at, std::string(defines) + "\n");
+	}
+
 	// utility function for checking shader compilation/linking errors.
 	// ------------------------------------------------------------------------
 	void checkCompileErrors(GLuint shader, std::string type)
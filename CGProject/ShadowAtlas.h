@@ -0,0 +1,336 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+//first texture unit of the atlas, one unit per tier
+#define SHADOW_ATLAS_TEXTURE_UNIT 18
+
+//depth cubes of the point lights packed in GL_TEXTURE_CUBE_MAP_ARRAY textures (GL 4.0 /
+//ARB_texture_cube_map_array), one array per resolution tier. every frame Assign hands the slots (one cube,
+//six layer-faces) out by the screen size of the light ranges: a light gets the finest tier it earns, moves
+//when that changes and gives its slot back when it is switched off. the shading pass samples every light
+//of a tier with the same sampler and the index of its cube, so the number of shadowed lights is bound by
+//the slots and not by the texture units.
+//like the maps of a light, a tier has an array for the static casters and the array the shading pass
+//samples, the copy with the dynamic casters on top (copy_image). without copy_image both are the same
+//array. what is drawn to the slots and when is left to the ShadowCache
+class ShadowAtlas
+{
+public:
+	static const unsigned int TIERS = 3;
+
+private:
+	//slot of a light, slot is -1 while it has none and tier is then the tier it asks for
+	struct LightSlot
+	{
+		unsigned int tier;
+		int slot;
+		float importance;
+	};
+
+	unsigned int staticTextures[TIERS];
+	unsigned int staticFBOs[TIERS];
+	//the arrays the shading pass samples, the static ones without copy_image
+	unsigned int textures[TIERS];
+	unsigned int FBOs[TIERS];
+	unsigned int sizes[TIERS];
+	bool copy;
+	//1 while a light holds the slot
+	vector<unsigned char> slots[TIERS];
+	vector<LightSlot> lights;
+	vector<unsigned int> order;
+	//camera the importance of the lights is measured from, screenScale is the height of the screen at distance 1
+	glm::vec3 viewerPosition;
+	float screenScale;
+	//bound while the tiers do not exist, a sampler needs a complete texture of its type
+	unsigned int placeholder;
+	bool supported;
+
+public:
+	ShadowAtlas()
+	{
+		for (unsigned int t = 0; t < TIERS; t++)
+			staticTextures[t] = staticFBOs[t] = textures[t] = FBOs[t] = sizes[t] = 0;
+		copy = false;
+		viewerPosition = glm::vec3(0.0f);
+		screenScale = 1.0f;
+		placeholder = 0;
+		supported = false;
+	}
+
+	void Init()
+	{
+		supported = GLEW_VERSION_4_0 || GLEW_ARB_texture_cube_map_array;
+		if (supported)
+			CreateArray(placeholder, 1, 1);
+	}
+
+	bool IsSupported() const
+	{
+		return supported;
+	}
+
+	//tier t holds SlotCount(t) cubes of mapSize >> t texels for up to lightCount lights. copyImage keeps
+	//the static casters in arrays of their own, like the maps of the lights with copy_image
+	void Create(unsigned int mapSize, unsigned int lightCount, bool copyImage)
+	{
+		if (!supported || IsCreated())
+			return;
+		copy = copyImage;
+		for (unsigned int t = 0; t < TIERS; t++)
+		{
+			sizes[t] = max(mapSize >> t, 1u);
+			slots[t].assign(SlotCount(t), 0);
+			CreateArray(staticTextures[t], sizes[t], SlotCount(t));
+			staticFBOs[t] = CreateFBO(staticTextures[t]);
+			textures[t] = staticTextures[t];
+			FBOs[t] = staticFBOs[t];
+			if (copy)
+			{
+				CreateArray(textures[t], sizes[t], SlotCount(t));
+				FBOs[t] = CreateFBO(textures[t]);
+			}
+		}
+
+		LightSlot none;
+		none.tier = 0;
+		none.slot = -1;
+		none.importance = 0.0f;
+		lights.assign(lightCount, none);
+	}
+
+	bool IsCreated() const
+	{
+		return staticTextures[0] != 0;
+	}
+
+	//deletes the tiers, every slot is given up
+	void Delete()
+	{
+		for (unsigned int t = 0; t < TIERS; t++)
+		{
+			if (textures[t] != staticTextures[t])
+			{
+				glDeleteTextures(1, &textures[t]);
+				glDeleteFramebuffers(1, &FBOs[t]);
+			}
+			if (staticTextures[t] != 0)
+			{
+				glDeleteTextures(1, &staticTextures[t]);
+				glDeleteFramebuffers(1, &staticFBOs[t]);
+			}
+			staticTextures[t] = staticFBOs[t] = textures[t] = FBOs[t] = sizes[t] = 0;
+			slots[t].clear();
+		}
+		lights.clear();
+	}
+
+	//the coarser tiers are cheaper, so they have more slots
+	static unsigned int SlotCount(unsigned int tier)
+	{
+		return 2u << tier;
+	}
+
+	//camera the screen size of the light ranges is measured from, fovY is the vertical field of view in radians
+	void SetViewer(const glm::vec3& position, float fovY)
+	{
+		viewerPosition = position;
+		screenScale = 2.0f * tan(fovY * 0.5f);
+	}
+
+	//spheres holds the position and range of every light, a range of 0 while it is off. the lights that are
+	//off give up their slots, lights whose tier changed move when the new tier has room. the lights without a
+	//slot then take one in order of importance, from their own tier or the closest one with room, coarser
+	//first. moved is set for the lights whose slot changed, the cube they had is gone
+	void Assign(const vector<glm::vec4>& spheres, vector<unsigned char>& moved)
+	{
+		moved.assign(lights.size(), 0);
+		order.clear();
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			LightSlot& light = lights[i];
+			if (spheres[i].w <= 0.0f)
+			{
+				moved[i] = light.slot >= 0;
+				FreeSlot(light);
+				continue;
+			}
+
+			light.importance = Importance(spheres[i]);
+			unsigned int tier = PickTier(light.importance, light.slot >= 0 ? (int)light.tier : -1);
+			if (light.slot >= 0 && tier != light.tier && HasFreeSlot(tier))
+				FreeSlot(light);
+			if (light.slot < 0)
+			{
+				light.tier = tier;
+				order.push_back(i);
+			}
+		}
+
+		std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b)
+		{
+			return lights[a].importance > lights[b].importance;
+		});
+		for (unsigned int o = 0; o < order.size(); o++)
+		{
+			LightSlot& light = lights[order[o]];
+			unsigned int wanted = light.tier;
+			for (unsigned int step = 0; step < TIERS && light.slot < 0; step++)
+			{
+				//wanted, then the coarser tiers, then the finer ones
+				light.tier = wanted + step < TIERS ? wanted + step : TIERS - 1 - step;
+				light.slot = TakeSlot(light.tier);
+			}
+			moved[order[o]] = 1;
+		}
+	}
+
+	//tier of the slot of light, -1 when it has none
+	int GetTier(unsigned int light) const
+	{
+		return light < lights.size() && lights[light].slot >= 0 ? (int)lights[light].tier : -1;
+	}
+
+	//cube of the slot of light in the arrays of its tier, -1 when it has none
+	int GetSlot(unsigned int light) const
+	{
+		return light < lights.size() ? lights[light].slot : -1;
+	}
+
+	unsigned int GetUsedSlots(unsigned int tier) const
+	{
+		return std::count(slots[tier].begin(), slots[tier].end(), 1);
+	}
+
+	//the array of tier the shading pass samples, the placeholder while the tiers do not exist
+	unsigned int GetTexture(unsigned int tier) const
+	{
+		return textures[tier] != 0 ? textures[tier] : placeholder;
+	}
+
+	//layered attachment of the sampled array
+	unsigned int GetFBO(unsigned int tier) const
+	{
+		return FBOs[tier];
+	}
+
+	//the array of the static casters, the sampled one without copy_image
+	unsigned int GetStaticTexture(unsigned int tier) const
+	{
+		return staticTextures[tier];
+	}
+
+	unsigned int GetStaticFBO(unsigned int tier) const
+	{
+		return staticFBOs[tier];
+	}
+
+	unsigned int GetSize(unsigned int tier) const
+	{
+		return sizes[tier];
+	}
+
+	//bytes of one slot of tier in every array, 24 bit depth is stored in 32 bits
+	unsigned int GetSlotMemory(unsigned int tier) const
+	{
+		return sizes[tier] * sizes[tier] * 4 * 6 * (copy ? 2 : 1);
+	}
+
+	//deletes the GL objects, must be called while the context is alive
+	void Release()
+	{
+		Delete();
+		if (placeholder != 0)
+			glDeleteTextures(1, &placeholder);
+		placeholder = 0;
+	}
+
+private:
+	//fraction of the screen height covered by the range of the light, more than 1 close to it
+	float Importance(const glm::vec4& sphere) const
+	{
+		float distance = glm::length(glm::vec3(sphere) - viewerPosition);
+		return 2.0f * sphere.w / (max(distance, 0.001f) * screenScale);
+	}
+
+	//finest tier the importance earns, current is the tier the light is in or -1
+	static unsigned int PickTier(float importance, int current)
+	{
+		//screen heights to earn tier 0 and 1. a light only changes tier once it is 20% past
+		//the boundary, so it does not flip between two tiers while the camera hovers around it
+		static const float thresholds[TIERS - 1] = { 1.0f, 0.3f };
+		const float hysteresis = 0.2f;
+
+		unsigned int tier = 0;
+		while (tier < TIERS - 1)
+		{
+			float threshold = thresholds[tier];
+			if (current >= 0)
+				threshold *= (int)tier < current ? 1.0f + hysteresis : 1.0f - hysteresis;
+			if (importance >= threshold)
+				break;
+			tier++;
+		}
+		return tier;
+	}
+
+	//index of a free cube of tier, -1 when all are taken
+	int TakeSlot(unsigned int tier)
+	{
+		for (unsigned int s = 0; s < slots[tier].size(); s++)
+		{
+			if (!slots[tier][s])
+			{
+				slots[tier][s] = 1;
+				return s;
+			}
+		}
+		return -1;
+	}
+
+	void FreeSlot(LightSlot& light)
+	{
+		if (light.slot >= 0)
+			slots[light.tier][light.slot] = 0;
+		light.slot = -1;
+	}
+
+	bool HasFreeSlot(unsigned int tier) const
+	{
+		return std::find(slots[tier].begin(), slots[tier].end(), 0) != slots[tier].end();
+	}
+
+	//compared in hardware like the cubemaps of the lights, the layers are the faces of cube 0 first
+	static void CreateArray(unsigned int& texID, unsigned int mapSize, unsigned int cubes)
+	{
+		glGenTextures(1, &texID);
+		glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, texID);
+		glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, GL_DEPTH_COMPONENT24, mapSize, mapSize, cubes * 6, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+		glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+	}
+
+	//layered depth attachment of the whole array
+	static unsigned int CreateFBO(unsigned int texID)
+	{
+		unsigned int FBO;
+		glGenFramebuffers(1, &FBO);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texID, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return FBO;
+	}
+};
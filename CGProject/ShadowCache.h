@@ -0,0 +1,1153 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "RenderQueue.h"
+#include "GpuTimer.h"
+#include "ShadowAtlas.h"
+
+#include <vector>
+#include <string>
+#include <algorithm>
+using namespace std;
+
+//how the depths around a point light are stored: six cube faces, or two paraboloid hemispheres
+//with a third of the texels and two layers to draw. the paraboloids spread the resolution less
+//evenly and bend large triangles, fine for small lights like the bedside lamp
+enum ShadowMapType
+{
+	SHADOW_CUBE,
+	SHADOW_PARABOLOID
+};
+
+//how the shading pass filters the cube maps: PCF taps of the depths, or a single fetch of EVSM
+//moments (exponential variance) that were blurred once when the map was drawn
+enum ShadowFilter
+{
+	SHADOW_FILTER_PCF,
+	SHADOW_FILTER_EVSM,
+	SHADOW_FILTERS
+};
+
+//keeps the depth cubemaps of the point lights between frames and only redraws the stale ones.
+//the static casters of a light are drawn to a map of their own, which is redrawn when the light
+//moves or a caster enters or leaves one of its faces (the face signatures of the shadow list change).
+//while dynamic casters are around, the static map is copied to a second map (copy_image, GL 4.3)
+//every frame and only the dynamic casters are drawn on top of it. without copy_image a single map
+//is kept and redrawn with all casters whenever something dynamic is in range.
+//in time sliced mode the stale faces of all lights are queued and only faceBudget of them are
+//redrawn per frame, faces with fast moving casters first and the others round-robin by waiting time.
+//the faces are drawn with one of the ShadowPath variants, the queue must build the commands of the same path.
+//lights with a dual-paraboloid map are cached the same way, but always redraw both hemispheres at once.
+//with the EVSM filter the sampled cube of a light is turned into moments at half its resolution and
+//blurred with a separable gaussian after every frame it changes, the cached maps are not filtered again.
+//the maps of a light are created the first frame it is on. in atlas mode the lights have no maps of their
+//own, they point into the slot the ShadowAtlas gave them instead: the static and the sampled array of the
+//tier stand in for the static and the dynamic map, and the passes only touch the layer-faces of the slot.
+//the slots are cached and time sliced like the maps, the atlas only holds cubes and is filtered with PCF
+class ShadowCache
+{
+	//a caster moving one unit per frame counts as much as a face waiting for this many frames
+	static const unsigned int FRAMES_PER_SPEED = 60;
+	//frames every path is timed for by the benchmark
+	static const unsigned int BENCHMARK_FRAMES = 120;
+	//the cube paths and then all lights as paraboloids
+	static const unsigned int BENCHMARK_STAGES = SHADOW_PATHS + 1;
+	static const unsigned int MAX_FILTER_RADIUS = 8;
+
+	struct LightMaps
+	{
+		ShadowMapType type;
+		//static casters only
+		unsigned int staticMap;
+		unsigned int staticFBO;
+		//copy of the static map with the dynamic casters on top
+		unsigned int dynamicMap;
+		unsigned int dynamicFBO;
+		//the map the shading pass samples this frame
+		unsigned int current;
+		//blurred moments of current, 0 with the PCF filter or a paraboloid map. filtered is cleared
+		//when the sampled map is drawn to, filteredMap is the map the moments were taken from
+		unsigned int momentMap;
+		bool filtered;
+		unsigned int filteredMap;
+		//state the static map was drawn with
+		glm::vec3 position;
+		uint64_t faceSignatures[6];
+		bool valid;
+
+		//time sliced state: static faces still to redraw, faces of the sampled map that hold
+		//dynamic casters and the frames each face has been waiting
+		unsigned char staleFaces;
+		unsigned char dynamicFaces;
+		unsigned int waiting[6];
+
+		//shadow view of the light this frame, view is -1 while the light is off
+		int view;
+		ShadowView shadowView;
+
+		//first layer-face of the atlas slot the maps point into and the size of the maps,
+		//layer is -1 for maps of the light's own
+		int layer;
+		unsigned int mapSize;
+		//the maps hold nothing of the light yet (new maps or a new slot), they are drawn whole
+		//even in time sliced mode
+		bool empty;
+
+		unsigned int GetLayerCount() const
+		{
+			return type == SHADOW_CUBE ? 6 : 2;
+		}
+	};
+
+	//a stale face of a light queued in time sliced mode
+	struct FaceUpdate
+	{
+		unsigned int light;
+		unsigned int face;
+		float priority;
+
+		bool operator<(const FaceUpdate& other) const
+		{
+			return priority > other.priority;
+		}
+	};
+
+	vector<LightMaps> lights;
+	unsigned int size;
+	bool copy;
+	bool sliced;
+	unsigned int faceBudget;
+	vector<FaceUpdate> updates;
+
+	//shadow shader of each path, NULL for the paths the driver can not run
+	Shader* shaders[SHADOW_PATHS];
+	Shader* paraboloidShader;
+	ShadowPath path;
+	float farPlane;
+	//map, first layer-face (-1 outside the atlas), view and faces of the pass started last
+	unsigned int passMap;
+	int passLayer;
+	const ShadowView* passView;
+	unsigned char passFaces;
+	ShadowMapType passType;
+	//1x1 maps bound to the sampler of the type a light does not use
+	unsigned int placeholderCube;
+	unsigned int placeholderArray;
+	unsigned int placeholderMoments;
+
+	//EVSM prefiltering, filterShader is NULL when it is not available
+	Shader* filterShader;
+	ShadowFilter filter;
+	unsigned int filterRadius;
+	unsigned int filterFBO;
+	//empty VAO for the fullscreen triangle, the vertices come from gl_VertexID
+	unsigned int filterVAO;
+	//reads the depth maps as values, their own parameters compare
+	unsigned int rawSampler;
+	//moments blurred along s, shared by the lights
+	unsigned int blurMap;
+	GpuTimer filterTimer;
+
+	ShadowAtlas atlas;
+	bool atlasMode;
+	//spheres of the lights handed to the atlas and the lights whose slot changed
+	vector<glm::vec4> spheres;
+	vector<unsigned char> moved;
+
+	//every stage redraws all maps for BENCHMARK_FRAMES frames, -1 when no benchmark runs
+	int benchmarkFrame;
+	ShadowPath benchmarkRestore;
+	vector<ShadowMapType> benchmarkTypes;
+	//set in the frame the last stage ends, until TakeBenchmarkResults
+	bool benchmarkDone;
+	GpuTimer timers[BENCHMARK_STAGES];
+	//maps drawn and maps reused in the last frame, faces in time sliced mode
+	unsigned int rendered;
+	unsigned int skipped;
+
+public:
+	ShadowCache()
+	{
+		size = 0;
+		copy = false;
+		sliced = false;
+		faceBudget = 2;
+		rendered = skipped = 0;
+		for (unsigned int p = 0; p < SHADOW_PATHS; p++)
+			shaders[p] = NULL;
+		paraboloidShader = NULL;
+		path = benchmarkRestore = SHADOW_GEOMETRY;
+		farPlane = 100.0f;
+		passMap = 0;
+		passView = NULL;
+		passFaces = 0x3F;
+		passType = SHADOW_CUBE;
+		placeholderCube = placeholderArray = placeholderMoments = 0;
+		filterShader = NULL;
+		filter = SHADOW_FILTER_PCF;
+		filterRadius = 3;
+		filterFBO = filterVAO = rawSampler = blurMap = 0;
+		atlasMode = false;
+		passLayer = -1;
+		benchmarkFrame = -1;
+		benchmarkDone = false;
+	}
+
+	//geometry, face and layer are the shadow shaders of the cube paths, layer is NULL without vertex shader
+	//layer support. paraboloid draws the two hemispheres of the dual-paraboloid maps, moments blurs the
+	//EVSM moments and may be NULL
+	void Init(unsigned int lightCount, unsigned int mapSize, Shader* geometry, Shader* face, Shader* layer, Shader* paraboloid,
+		Shader* moments)
+	{
+		shaders[SHADOW_GEOMETRY] = geometry;
+		shaders[SHADOW_PER_FACE] = face;
+		shaders[SHADOW_VERTEX_LAYER] = layer;
+		paraboloidShader = paraboloid;
+		size = mapSize;
+		copy = GLEW_VERSION_4_3 || GLEW_ARB_copy_image;
+
+		lights.resize(lightCount);
+		for (unsigned int i = 0; i < lightCount; i++)
+		{
+			lights[i].type = SHADOW_CUBE;
+			lights[i].view = -1;
+			lights[i].layer = -1;
+			lights[i].staticMap = lights[i].staticFBO = lights[i].dynamicMap = lights[i].dynamicFBO = 0;
+			lights[i].current = lights[i].momentMap = 0;
+			ResetMaps(lights[i]);
+		}
+		atlas.Init();
+
+		//sampling a unit without a complete texture of the sampler type is undefined
+		glGenTextures(1, &placeholderCube);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, placeholderCube);
+		for (unsigned int i = 0; i < 6; ++i)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT24, 1, 1, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		SetCompareMode(GL_TEXTURE_CUBE_MAP);
+		glGenTextures(1, &placeholderArray);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, placeholderArray);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, 1, 1, 2, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		SetCompareMode(GL_TEXTURE_2D_ARRAY);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		CreateMomentMap(placeholderMoments, 1);
+
+		filterShader = moments;
+		if (filterShader != NULL)
+		{
+			glGenFramebuffers(1, &filterFBO);
+			glGenVertexArrays(1, &filterVAO);
+			glGenSamplers(1, &rawSampler);
+			glSamplerParameteri(rawSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glSamplerParameteri(rawSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glSamplerParameteri(rawSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glSamplerParameteri(rawSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glSamplerParameteri(rawSampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+			glSamplerParameteri(rawSampler, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+		}
+	}
+
+	//deletes the maps of light, the new ones are created the next frame the light is on.
+	//the atlas only holds cubes, the type does not change while it is on
+	void SetMapType(unsigned int light, ShadowMapType type)
+	{
+		LightMaps& maps = lights[light];
+		if (maps.type == type || atlasMode)
+			return;
+		DeleteMaps(maps);
+		maps.type = type;
+	}
+
+	ShadowMapType GetMapType(unsigned int light) const
+	{
+		return lights[light].type;
+	}
+
+	//bytes of texture memory the maps of light hold while it is on, the copy for the dynamic casters
+	//included, or its atlas slot
+	unsigned int GetMemory(unsigned int light) const
+	{
+		if (atlasMode)
+			return atlas.GetTier(light) >= 0 ? atlas.GetSlotMemory(atlas.GetTier(light)) : 0;
+		bool moments = filter == SHADOW_FILTER_EVSM && lights[light].type == SHADOW_CUBE;
+		return MapMemory(lights[light].type) + (moments ? MomentSize() * MomentSize() * 16 * 6 : 0);
+	}
+
+	unsigned int MapMemory(ShadowMapType type) const
+	{
+		//24 bit depth is stored in 32 bits
+		unsigned int layers = type == SHADOW_CUBE ? 6 : 2;
+		return size * size * 4 * layers * (copy ? 2 : 1);
+	}
+
+	//switches between redrawing every stale map at once and the per frame face budget
+	void SetTimeSliced(bool enable)
+	{
+		if (enable == sliced)
+			return;
+		sliced = enable;
+
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			LightMaps& maps = lights[i];
+			if (sliced)
+			{
+				if (maps.type == SHADOW_CUBE)
+					StartSlicing(maps);
+			}
+			else
+			{
+				//faces still queued, or the single map holding dynamic casters, redraw on the next frame
+				maps.valid = maps.valid && maps.staleFaces == 0 && (copy || maps.dynamicFaces == 0);
+				maps.current = maps.staticMap;
+			}
+		}
+	}
+
+	bool IsTimeSliced() const
+	{
+		return sliced;
+	}
+
+	bool IsPathSupported(ShadowPath shadowPath) const
+	{
+		return shaders[shadowPath] != NULL;
+	}
+
+	//the maps are redrawn with the new path the next time they are stale
+	void SetPath(ShadowPath shadowPath)
+	{
+		if (IsPathSupported(shadowPath))
+			path = shadowPath;
+	}
+
+	ShadowPath GetPath() const
+	{
+		return path;
+	}
+
+	bool IsFilterSupported(ShadowFilter shadowFilter) const
+	{
+		return shadowFilter == SHADOW_FILTER_PCF || (filterShader != NULL && !atlasMode);
+	}
+
+	//creates or deletes the moment maps, the cubes are filtered the next frame their light is on
+	void SetFilter(ShadowFilter shadowFilter)
+	{
+		if (shadowFilter == filter || !IsFilterSupported(shadowFilter))
+			return;
+		filter = shadowFilter;
+
+		if (filter == SHADOW_FILTER_EVSM)
+			CreateMomentMap(blurMap, MomentSize());
+		else
+		{
+			glDeleteTextures(1, &blurMap);
+			blurMap = 0;
+		}
+		//the lights without maps get their moments with them
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			DeleteMomentMap(lights[i]);
+			if (filter == SHADOW_FILTER_EVSM && lights[i].type == SHADOW_CUBE && lights[i].staticMap != 0)
+				CreateMomentMap(lights[i].momentMap, MomentSize());
+		}
+	}
+
+	ShadowFilter GetFilter() const
+	{
+		return filter;
+	}
+
+	static const char* GetFilterName(ShadowFilter shadowFilter)
+	{
+		static const char* names[SHADOW_FILTERS] = { "pcf", "evsm" };
+		return names[shadowFilter];
+	}
+
+	//taps on each side of the blur, applied the next time a map changes
+	void SetFilterRadius(unsigned int radius)
+	{
+		filterRadius = min(max(radius, 1u), MAX_FILTER_RADIUS);
+	}
+
+	unsigned int GetFilterRadius() const
+	{
+		return filterRadius;
+	}
+
+	//positive and negative exponent of the depth warp. the squares of the positive moment must fit in
+	//a 32 bit float, the distances are divided by far_plane so the depths are at most 1
+	static glm::vec2 GetMomentExponents()
+	{
+		return glm::vec2(40.0f, 5.0f);
+	}
+
+	//average GPU time of the frames that filtered moments
+	float GetFilterTime() const
+	{
+		return filterTimer.GetAverage();
+	}
+
+	bool IsAtlasSupported() const
+	{
+		return atlas.IsSupported();
+	}
+
+	//creates the atlas and deletes the maps of the lights, they take slots from the next frame on. or deletes
+	//the atlas, the lights then get maps again the next frame they are on. the atlas only holds cubes filtered
+	//with PCF, the lights with paraboloids become cubes. the benchmark times the maps, it is not switched meanwhile
+	void SetAtlas(bool enable)
+	{
+		if (enable == atlasMode || (enable && !atlas.IsSupported()) || benchmarkFrame >= 0)
+			return;
+		if (enable)
+		{
+			SetFilter(SHADOW_FILTER_PCF);
+			atlas.Create(size, lights.size(), copy);
+		}
+		else
+			atlas.Delete();
+		atlasMode = enable;
+
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			DeleteMaps(lights[i]);
+			lights[i].type = SHADOW_CUBE;
+		}
+	}
+
+	bool IsAtlas() const
+	{
+		return atlasMode;
+	}
+
+	//camera the screen size of the light ranges is measured from, fovY is the vertical field of view in radians
+	void SetViewer(const glm::vec3& position, float fovY)
+	{
+		atlas.SetViewer(position, fovY);
+	}
+
+	//tier of the atlas slot of light, -1 when it has none or the atlas is off
+	int GetAtlasTier(unsigned int light) const
+	{
+		return atlasMode ? atlas.GetTier(light) : -1;
+	}
+
+	//cube of the atlas slot of light in the array of its tier, -1 when it has none
+	int GetAtlasSlot(unsigned int light) const
+	{
+		return atlasMode ? atlas.GetSlot(light) : -1;
+	}
+
+	//cube map array of an atlas tier, a placeholder while the atlas is off
+	unsigned int GetAtlasMap(unsigned int tier) const
+	{
+		return atlas.GetTexture(tier);
+	}
+
+	unsigned int GetAtlasSize(unsigned int tier) const
+	{
+		return atlas.GetSize(tier);
+	}
+
+	unsigned int GetAtlasUsedSlots(unsigned int tier) const
+	{
+		return atlas.GetUsedSlots(tier);
+	}
+
+	static const char* GetPathName(ShadowPath shadowPath)
+	{
+		static const char* names[SHADOW_PATHS] = { "geometry shader", "per face passes", "vertex shader layer" };
+		return names[shadowPath];
+	}
+
+	//times every supported cube path and then the paraboloids over the next frames, each of them
+	//redrawing all maps of the lights that are on every frame, the averages are read with GetBenchmarkTime when done.
+	//the paraboloids have no slots, so it does not run in atlas mode
+	void StartBenchmark()
+	{
+		if (benchmarkFrame >= 0 || atlasMode)
+			return;
+		benchmarkRestore = path;
+		benchmarkTypes.resize(lights.size());
+		for (unsigned int i = 0; i < lights.size(); i++)
+			benchmarkTypes[i] = lights[i].type;
+		benchmarkFrame = 0;
+	}
+
+	bool IsBenchmarking() const
+	{
+		return benchmarkFrame >= 0;
+	}
+
+	//cube faces redrawn per frame in time sliced mode, over all lights
+	void SetFaceBudget(unsigned int budget)
+	{
+		faceBudget = max(budget, 1u);
+	}
+
+	unsigned int GetFaceBudget() const
+	{
+		return faceBudget;
+	}
+
+	//selects the path of the frame, the queue must be set to GetPath before it sorts
+	void BeginFrame()
+	{
+		for (unsigned int i = 0; i < lights.size(); i++)
+			lights[i].view = -1;
+
+		if (benchmarkFrame < 0)
+			return;
+		while (benchmarkFrame < (int)(SHADOW_PATHS * BENCHMARK_FRAMES) &&
+			!IsPathSupported((ShadowPath)(benchmarkFrame / BENCHMARK_FRAMES)))
+			benchmarkFrame += BENCHMARK_FRAMES;
+
+		if (benchmarkFrame == BENCHMARK_STAGES * BENCHMARK_FRAMES)
+		{
+			path = benchmarkRestore;
+			benchmarkFrame = -1;
+			benchmarkDone = true;
+			for (unsigned int i = 0; i < lights.size(); i++)
+				SetMapType(i, benchmarkTypes[i]);
+			//the benchmark drew whole maps, the sliced state starts again from them
+			for (unsigned int i = 0; sliced && i < lights.size(); i++)
+			{
+				if (lights[i].type == SHADOW_CUBE)
+					StartSlicing(lights[i]);
+			}
+			return;
+		}
+
+		unsigned int stage = benchmarkFrame / BENCHMARK_FRAMES;
+		if (stage < SHADOW_PATHS)
+			path = (ShadowPath)stage;
+		else
+		{
+			path = benchmarkRestore;
+			for (unsigned int i = 0; i < lights.size(); i++)
+				SetMapType(i, SHADOW_PARABOLOID);
+		}
+		benchmarkFrame++;
+		for (unsigned int i = 0; i < lights.size(); i++)
+			lights[i].valid = false;
+	}
+
+	//true once after the benchmark finished, the results are then read with GetBenchmarkTime
+	bool TakeBenchmarkResults()
+	{
+		bool done = benchmarkDone;
+		benchmarkDone = false;
+		return done;
+	}
+
+	//average time to redraw all maps with a cube path, or the dual-paraboloid maps for SHADOW_PATHS
+	float GetBenchmarkTime(unsigned int stage) const
+	{
+		return timers[stage].GetAverage();
+	}
+
+	//stage of the benchmark the timer of the frame belongs to
+	unsigned int BenchmarkStage() const
+	{
+		return (benchmarkFrame - 1) / BENCHMARK_FRAMES;
+	}
+
+	//the light is on this frame and its casters are in view of queue, sorted this frame
+	void Update(unsigned int light, unsigned int view, const ShadowView& shadowView)
+	{
+		lights[light].view = view;
+		lights[light].shadowView = shadowView;
+	}
+
+	//brings the maps of the lights updated this frame up to date with their shadow lists,
+	//the shadow shaders get the cube face matrices and the light position from here
+	void Render(RenderQueue& queue, float farPlane)
+	{
+		this->farPlane = farPlane;
+		rendered = skipped = 0;
+		if (atlasMode)
+			AssignSlots();
+		for (unsigned int i = 0; i < lights.size() && !atlasMode; i++)
+		{
+			if (lights[i].view >= 0 && lights[i].staticMap == 0)
+				CreateMaps(lights[i]);
+		}
+
+		if (benchmarkFrame >= 0)
+			timers[BenchmarkStage()].Begin();
+		bool slicing = sliced && benchmarkFrame < 0;
+		if (slicing)
+			RenderSliced(queue);
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			//off, or in atlas mode without a slot
+			LightMaps& maps = lights[i];
+			if (maps.view < 0 || maps.staticMap == 0)
+				continue;
+			//the paraboloids are never time sliced, maps that hold nothing yet are drawn whole first
+			bool empty = maps.empty;
+			maps.empty = false;
+			if (!slicing || maps.type != SHADOW_CUBE || empty)
+				RenderLight(maps, queue);
+			if (slicing && maps.type == SHADOW_CUBE && empty)
+				StartSlicing(maps);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		if (benchmarkFrame >= 0)
+			timers[BenchmarkStage()].End();
+
+		//after the benchmark timer, GL_TIME_ELAPSED queries do not nest
+		if (filter == SHADOW_FILTER_EVSM)
+			FilterLights();
+	}
+
+	//depth cubemap to sample for light, a placeholder when the light has paraboloids, no maps yet or a slot
+	unsigned int GetCubeMap(unsigned int light) const
+	{
+		const LightMaps& maps = lights[light];
+		return maps.type == SHADOW_CUBE && maps.layer < 0 && maps.current != 0 ? maps.current : placeholderCube;
+	}
+
+	//blurred moments of the cube of light, a placeholder with the PCF filter or a paraboloid map
+	unsigned int GetMomentMap(unsigned int light) const
+	{
+		return lights[light].momentMap != 0 ? lights[light].momentMap : placeholderMoments;
+	}
+
+	//2 layer array of the hemispheres of light, a placeholder when the light has a cubemap or no maps yet
+	unsigned int GetParaboloidMap(unsigned int light) const
+	{
+		const LightMaps& maps = lights[light];
+		return maps.type == SHADOW_PARABOLOID && maps.current != 0 ? maps.current : placeholderArray;
+	}
+
+	unsigned int GetRenderedCount() const
+	{
+		return rendered;
+	}
+
+	unsigned int GetSkippedCount() const
+	{
+		return skipped;
+	}
+
+	//deletes the GL objects, must be called while the context is alive
+	void Release()
+	{
+		for (unsigned int s = 0; s < BENCHMARK_STAGES; s++)
+			timers[s].Release();
+		filterTimer.Release();
+		for (unsigned int i = 0; i < lights.size(); i++)
+			DeleteMaps(lights[i]);
+		lights.clear();
+		if (placeholderCube != 0)
+		{
+			glDeleteTextures(1, &placeholderCube);
+			glDeleteTextures(1, &placeholderArray);
+			glDeleteTextures(1, &placeholderMoments);
+		}
+		placeholderCube = placeholderArray = placeholderMoments = 0;
+		if (filterFBO != 0)
+		{
+			glDeleteFramebuffers(1, &filterFBO);
+			glDeleteVertexArrays(1, &filterVAO);
+			glDeleteSamplers(1, &rawSampler);
+		}
+		if (blurMap != 0)
+			glDeleteTextures(1, &blurMap);
+		filterFBO = filterVAO = rawSampler = blurMap = 0;
+		atlas.Release();
+		atlasMode = false;
+	}
+
+private:
+	//hands the atlas slots out for this frame and points the lights whose slot changed at the arrays of
+	//their tier, a light without a slot is left without maps and not drawn
+	void AssignSlots()
+	{
+		spheres.assign(lights.size(), glm::vec4(0.0f));
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			if (lights[i].view >= 0)
+				spheres[i] = glm::vec4(lights[i].shadowView.position, lights[i].shadowView.range);
+		}
+		atlas.Assign(spheres, moved);
+
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			if (!moved[i])
+				continue;
+			LightMaps& maps = lights[i];
+			DeleteMaps(maps);
+			int tier = atlas.GetTier(i);
+			if (tier < 0)
+				continue;
+			maps.staticMap = atlas.GetStaticTexture(tier);
+			maps.staticFBO = atlas.GetStaticFBO(tier);
+			if (copy)
+			{
+				maps.dynamicMap = atlas.GetTexture(tier);
+				maps.dynamicFBO = atlas.GetFBO(tier);
+			}
+			maps.current = atlas.GetTexture(tier);
+			maps.layer = atlas.GetSlot(i) * 6;
+			maps.mapSize = atlas.GetSize(tier);
+			ResetMaps(maps);
+		}
+	}
+
+	//the sliced mode composes every face into the sampled map, starts it from the static casters.
+	//maps that hold nothing yet are drawn whole before
+	void StartSlicing(LightMaps& maps)
+	{
+		if (maps.empty)
+			return;
+		maps.staleFaces = maps.valid ? 0 : 0x3F;
+		maps.dynamicFaces = 0;
+		if (copy)
+		{
+			CopyLayers(maps, 0, 6);
+			maps.current = maps.dynamicMap;
+		}
+		for (unsigned int f = 0; f < 6; f++)
+			maps.waiting[f] = 0;
+	}
+
+	//copies layers of the static map to the dynamic one (copy_image), the layers of the slot in the atlas
+	void CopyLayers(const LightMaps& maps, unsigned int first, unsigned int count)
+	{
+		GLenum target = maps.layer >= 0 ? GL_TEXTURE_CUBE_MAP_ARRAY : maps.type == SHADOW_CUBE ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D_ARRAY;
+		unsigned int layer = max(maps.layer, 0) + first;
+		glCopyImageSubData(maps.staticMap, target, 0, 0, 0, layer,
+			maps.dynamicMap, target, 0, 0, 0, layer, maps.mapSize, maps.mapSize, count);
+	}
+
+	void CreateMaps(LightMaps& maps)
+	{
+		CreateMap(maps.staticMap, maps.staticFBO, maps.type);
+		maps.dynamicMap = maps.dynamicFBO = 0;
+		if (copy)
+			CreateMap(maps.dynamicMap, maps.dynamicFBO, maps.type);
+		maps.current = maps.staticMap;
+		maps.layer = -1;
+		maps.mapSize = size;
+		maps.momentMap = 0;
+		if (filter == SHADOW_FILTER_EVSM && maps.type == SHADOW_CUBE)
+			CreateMomentMap(maps.momentMap, MomentSize());
+		ResetMaps(maps);
+	}
+
+	//forgets what the maps hold, they are drawn whole the next frame the light is on
+	static void ResetMaps(LightMaps& maps)
+	{
+		maps.filtered = false;
+		maps.filteredMap = 0;
+		maps.position = glm::vec3(0.0f);
+		maps.valid = false;
+		maps.empty = true;
+		maps.staleFaces = 0x3F;
+		maps.dynamicFaces = 0;
+		for (unsigned int f = 0; f < 6; f++)
+		{
+			maps.faceSignatures[f] = 0;
+			maps.waiting[f] = 0;
+		}
+	}
+
+	//the arrays of an atlas slot belong to the atlas, the light only lets go of them. the light is
+	//drawn whole into the maps it gets next
+	void DeleteMaps(LightMaps& maps)
+	{
+		if (maps.layer < 0 && maps.staticMap != 0)
+		{
+			glDeleteTextures(1, &maps.staticMap);
+			glDeleteFramebuffers(1, &maps.staticFBO);
+			if (maps.dynamicMap != 0)
+			{
+				glDeleteTextures(1, &maps.dynamicMap);
+				glDeleteFramebuffers(1, &maps.dynamicFBO);
+			}
+		}
+		maps.staticMap = maps.staticFBO = maps.dynamicMap = maps.dynamicFBO = maps.current = 0;
+		maps.layer = -1;
+		DeleteMomentMap(maps);
+		ResetMaps(maps);
+	}
+
+	void DeleteMomentMap(LightMaps& maps)
+	{
+		if (maps.momentMap != 0)
+			glDeleteTextures(1, &maps.momentMap);
+		maps.momentMap = 0;
+		maps.filtered = false;
+		maps.filteredMap = 0;
+	}
+
+	unsigned int MomentSize() const
+	{
+		return max(size / 2, 1u);
+	}
+
+	//four 32 bit moments per texel, the positive warp overflows half floats
+	static void CreateMomentMap(unsigned int& texID, unsigned int mapSize)
+	{
+		glGenTextures(1, &texID);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, texID);
+		for (unsigned int i = 0; i < 6; ++i)
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA32F, mapSize, mapSize, 0, GL_RGBA, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+	}
+
+	//filters the cubes of the lights that are on and changed since they were filtered last
+	void FilterLights()
+	{
+		bool started = false;
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			LightMaps& maps = lights[i];
+			if (maps.view < 0 || maps.momentMap == 0 || (maps.filtered && maps.filteredMap == maps.current))
+				continue;
+			if (!started)
+			{
+				filterTimer.Begin();
+				StartFilter();
+				started = true;
+			}
+			FilterMoments(maps);
+		}
+		if (!started)
+			return;
+
+		glBindSampler(0, 0);
+		glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+		glBindVertexArray(0);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		filterTimer.End();
+	}
+
+	void StartFilter()
+	{
+		unsigned int momentSize = MomentSize();
+		glViewport(0, 0, momentSize, momentSize);
+		glBindFramebuffer(GL_FRAMEBUFFER, filterFBO);
+		glBindVertexArray(filterVAO);
+		glUseProgram(filterShader->ID);
+		filterShader->setInt("source", 0);
+		filterShader->setInt("radius", filterRadius);
+		filterShader->setFloat("texelSize", 2.0f / momentSize);
+		filterShader->setVec2("exponents", GetMomentExponents());
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	//the depths of the sampled map go to moments blurred along s in blurMap, then along t in the
+	//moment map. the blur reads across the face edges, so all faces are filtered again whenever
+	//one of them was redrawn
+	void FilterMoments(LightMaps& maps)
+	{
+		for (unsigned int stage = 0; stage < 2; stage++)
+		{
+			filterShader->setInt("stage", stage);
+			glBindTexture(GL_TEXTURE_CUBE_MAP, stage == 0 ? maps.current : blurMap);
+			glBindSampler(0, stage == 0 ? rawSampler : 0);
+			unsigned int target = stage == 0 ? blurMap : maps.momentMap;
+			for (unsigned int f = 0; f < 6; f++)
+			{
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + f, target, 0);
+				filterShader->setInt("face", f);
+				glDrawArrays(GL_TRIANGLES, 0, 3);
+			}
+		}
+		maps.filtered = true;
+		maps.filteredMap = maps.current;
+	}
+
+	void RenderLight(LightMaps& maps, RenderQueue& queue)
+	{
+		unsigned int view = maps.view;
+		bool dynamic = queue.GetShadowCasterCount(view, SHADOW_DYNAMIC) > 0;
+		bool stale = !maps.valid || maps.position != maps.shadowView.position;
+		for (unsigned int f = 0; f < 6; f++)
+			stale = stale || maps.faceSignatures[f] != queue.GetShadowSignature(view, SHADOW_STATIC, f);
+
+		bool drawn = stale || (dynamic && !copy);
+		if (drawn)
+		{
+			BeginPass(maps, maps.staticFBO, maps.staticMap);
+			DrawCasters(queue, view, SHADOW_STATIC);
+			if (!copy)
+				DrawCasters(queue, view, SHADOW_DYNAMIC);
+			rendered++;
+			maps.filtered = false;
+
+			maps.position = maps.shadowView.position;
+			for (unsigned int f = 0; f < 6; f++)
+				maps.faceSignatures[f] = queue.GetShadowSignature(view, SHADOW_STATIC, f);
+			//the single map holds the dynamic casters too, it is stale once they are gone
+			maps.valid = copy || !dynamic;
+		}
+		else if (!dynamic)
+		{
+			skipped++;
+		}
+
+		//an atlas slot is always sampled from the copy, which follows every change of the static
+		//map and drops the dynamic casters once they are gone
+		bool shared = copy && maps.layer >= 0;
+		maps.current = shared ? maps.dynamicMap : maps.staticMap;
+		if (copy && (dynamic || (shared && (drawn || maps.dynamicFaces != 0))))
+		{
+			CopyLayers(maps, 0, maps.GetLayerCount());
+			if (dynamic)
+			{
+				BeginPass(maps, maps.dynamicFBO, maps.dynamicMap, false);
+				DrawCasters(queue, view, SHADOW_DYNAMIC);
+				rendered++;
+			}
+			maps.current = maps.dynamicMap;
+			maps.filtered = false;
+		}
+		maps.dynamicFaces = dynamic ? 0x3F : 0;
+	}
+
+	//marks the stale faces of the lights that are on, then redraws the faceBudget most urgent ones
+	void RenderSliced(RenderQueue& queue)
+	{
+		updates.clear();
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			LightMaps& maps = lights[i];
+			if (maps.view < 0 || maps.type != SHADOW_CUBE || maps.staticMap == 0 || maps.empty)
+				continue;
+
+			if (!maps.valid || maps.position != maps.shadowView.position)
+			{
+				maps.staleFaces = 0x3F;
+				maps.position = maps.shadowView.position;
+				maps.valid = true;
+			}
+			for (unsigned int f = 0; f < 6; f++)
+			{
+				uint64_t signature = queue.GetShadowSignature(maps.view, SHADOW_STATIC, f);
+				if (signature != maps.faceSignatures[f])
+				{
+					maps.staleFaces |= 1 << f;
+					maps.faceSignatures[f] = signature;
+				}
+
+				//faces with dynamic casters now, or still showing the ones that left
+				bool dynamic = queue.GetShadowCasters(maps.view, f, SHADOW_DYNAMIC) > 0;
+				if (!dynamic && !(maps.staleFaces & (1 << f)) && !(maps.dynamicFaces & (1 << f)))
+				{
+					maps.waiting[f] = 0;
+					continue;
+				}
+
+				maps.waiting[f]++;
+				FaceUpdate update;
+				update.light = i;
+				update.face = f;
+				update.priority = maps.waiting[f] + queue.GetShadowSpeed(maps.view, f) * FRAMES_PER_SPEED;
+				updates.push_back(update);
+			}
+		}
+
+		unsigned int count = min((unsigned int)updates.size(), faceBudget);
+		partial_sort(updates.begin(), updates.begin() + count, updates.end());
+		skipped = updates.size() - count;
+
+		//one pass per light over the faces picked for it
+		vector<unsigned char> faceMasks(lights.size(), 0);
+		for (unsigned int u = 0; u < count; u++)
+			faceMasks[updates[u].light] |= 1 << updates[u].face;
+		for (unsigned int i = 0; i < lights.size(); i++)
+		{
+			if (faceMasks[i] != 0)
+				RenderFaces(lights[i], faceMasks[i], queue);
+		}
+		rendered = count;
+	}
+
+	//redraws the faces of mask into the sampled map
+	void RenderFaces(LightMaps& maps, unsigned char mask, RenderQueue& queue)
+	{
+		unsigned int view = maps.view;
+		unsigned char dynamicMask = 0;
+		for (unsigned int f = 0; f < 6; f++)
+		{
+			if (queue.GetShadowCasters(view, f, SHADOW_DYNAMIC) > 0)
+				dynamicMask |= 1 << f;
+			if (mask & (1 << f))
+				maps.waiting[f] = 0;
+		}
+		dynamicMask &= mask;
+
+		if (copy)
+		{
+			unsigned char staticMask = mask & maps.staleFaces;
+			if (staticMask != 0)
+			{
+				BeginPass(maps, maps.staticFBO, maps.staticMap, false, staticMask);
+				ClearFaces(staticMask);
+				DrawCasters(queue, view, SHADOW_STATIC);
+			}
+			for (unsigned int f = 0; f < 6; f++)
+			{
+				if (mask & (1 << f))
+					CopyLayers(maps, f, 1);
+			}
+			if (dynamicMask != 0)
+			{
+				BeginPass(maps, maps.dynamicFBO, maps.dynamicMap, false, dynamicMask);
+				DrawCasters(queue, view, SHADOW_DYNAMIC);
+			}
+			maps.current = maps.dynamicMap;
+		}
+		else
+		{
+			BeginPass(maps, maps.staticFBO, maps.staticMap, false, mask);
+			ClearFaces(mask);
+			DrawCasters(queue, view, SHADOW_STATIC);
+			DrawCasters(queue, view, SHADOW_DYNAMIC);
+		}
+
+		maps.staleFaces &= ~mask;
+		maps.dynamicFaces = (maps.dynamicFaces & ~mask) | dynamicMask;
+		maps.filtered = false;
+	}
+
+	//sized format so both maps of a light are copy compatible. the paraboloids are a 2 layer array
+	void CreateMap(unsigned int& texID, unsigned int& FBO, ShadowMapType type)
+	{
+		glGenFramebuffers(1, &FBO);
+
+		GLenum target = type == SHADOW_CUBE ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D_ARRAY;
+		glGenTextures(1, &texID);
+		glBindTexture(target, texID);
+
+		glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(target, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+		SetCompareMode(target);
+
+		if (type == SHADOW_CUBE)
+		{
+			for (unsigned int i = 0; i < 6; ++i)
+				glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		}
+		else
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, size, size, 2, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+		glBindTexture(target, 0);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texID, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	//the fragment shader samples the maps with shadow samplers, with linear filtering every tap
+	//returns the lit fraction of the 4 nearest texels
+	static void SetCompareMode(GLenum target)
+	{
+		glTexParameteri(target, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+		glTexParameteri(target, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	}
+
+	//the layered attachment clears all its layers, so the faces of mask are attached one by one
+	void ClearFaces(unsigned char mask)
+	{
+		for (unsigned int f = 0; f < 6; f++)
+		{
+			if (!(mask & (1 << f)))
+				continue;
+			AttachFace(f);
+			glClear(GL_DEPTH_BUFFER_BIT);
+		}
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, passMap, 0);
+	}
+
+	//attaches a single face of the map of the pass started last, a layer-face of the slot in the atlas
+	void AttachFace(unsigned int face)
+	{
+		if (passLayer >= 0)
+			glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, passMap, 0, passLayer + face);
+		else
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, passMap, 0);
+	}
+
+	//texID is the map of the light attached to FBO, faces the set of cube faces drawn by the pass (a bit per face).
+	//the maps of an atlas slot are the arrays of its tier, the shaders offset their layers to the slot
+	void BeginPass(const LightMaps& maps, unsigned int FBO, unsigned int texID,
+		bool clear = true, unsigned char faces = 0x3F)
+	{
+		const ShadowView& shadowView = maps.shadowView;
+		glViewport(0, 0, maps.mapSize, maps.mapSize);
+		glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+		passMap = texID;
+		passLayer = maps.layer;
+		if (clear && passLayer >= 0)
+			ClearFaces(0x3F);
+		else if (clear)
+			glClear(GL_DEPTH_BUFFER_BIT);
+
+		Shader& shader = maps.type == SHADOW_CUBE ? *shaders[path] : *paraboloidShader;
+		glUseProgram(shader.ID);
+		for (unsigned int f = 0; f < 6; ++f)
+			shader.setMat4("shadowMatrices[" + std::to_string(f) + "]", shadowView.faces[f]);
+		shader.setFloat("far_plane", farPlane);
+		shader.setVec3("lightPos", shadowView.position);
+		shader.setInt("skipFaces", ~faces & 0x3F);
+		shader.setInt("firstLayer", max(maps.layer, 0));
+
+		passView = &shadowView;
+		passFaces = faces;
+		passType = maps.type;
+	}
+
+	//draws a layer of the casters of view to the faces of the pass started last, with the selected path
+	void DrawCasters(RenderQueue& queue, unsigned int view, ShadowLayer layer)
+	{
+		if (passType == SHADOW_PARABOLOID)
+		{
+			//the geometry shader cuts the triangles at the rim of the hemispheres
+			glEnable(GL_CLIP_DISTANCE0);
+			queue.ExecuteShadows(view, layer, paraboloidShader);
+			glDisable(GL_CLIP_DISTANCE0);
+			return;
+		}
+
+		Shader* shader = shaders[path];
+		if (path == SHADOW_PER_FACE)
+		{
+			for (unsigned int f = 0; f < 6; f++)
+			{
+				if (!(passFaces & (1 << f)))
+					continue;
+				AttachFace(f);
+				shader->setMat4("shadowMatrix", passView->faces[f]);
+				queue.ExecuteShadowFace(view, layer, f, shader);
+			}
+			glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, passMap, 0);
+		}
+		else if (path == SHADOW_VERTEX_LAYER)
+			queue.ExecuteShadowsLayered(view, layer, shader);
+		else
+			queue.ExecuteShadows(view, layer, shader);
+	}
+};
@@ -0,0 +1,457 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <xmmintrin.h>
+
+#include "Mesh.h"
+#include "OcclusionTest.h"
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+using namespace std;
+
+//CPU occlusion culling: the designated occluders (walls, floor) are rasterized into a small
+//depth buffer by worker threads while the main thread walks the scene, then the boxes of the
+//objects are tested against the farthest depth of every 8x8 tile they cover.
+//each worker transforms and clips a share of the triangles, then after a barrier it rasterizes
+//all of them into its own band of rows (4 pixels at a time with SSE), so the bands need no locks
+class SoftwareOcclusion : public IOcclusionTest
+{
+public:
+	static const int WIDTH = 320;
+	static const int HEIGHT = 240;
+	static const int TILE = 8;
+	static const int TILES_X = WIDTH / TILE;
+	static const int TILES_Y = HEIGHT / TILE;
+
+private:
+	struct Occluder
+	{
+		const Mesh* mesh;
+		glm::mat4 model;
+		//first triangle of the mesh in the triangle numbering of all occluders
+		unsigned int firstTriangle;
+	};
+
+	//screen space triangle, x and y in pixels, z in [0, 1]
+	struct ScreenTriangle
+	{
+		float x[3], y[3], z[3];
+	};
+
+	vector<Occluder> occluders;
+	unsigned int triangleCount;
+	glm::mat4 viewProj;
+
+	vector<float> depth;
+	//farthest depth of each tile
+	vector<float> tileDepth;
+	//setup triangles of each worker
+	vector<vector<ScreenTriangle> > triangles;
+
+	vector<thread> workers;
+	unsigned int workerCount;
+	mutex lock;
+	condition_variable wake, done;
+	unsigned int generation;
+	unsigned int busy;
+	bool quit;
+	atomic<unsigned int> arrived;
+	bool pending;
+	//the depth buffer holds the occluders of the current frame
+	bool ready;
+	bool enabled;
+
+	chrono::high_resolution_clock::time_point start;
+	vector<chrono::high_resolution_clock::time_point> finish;
+	float rasterTime;
+	unsigned int occludedCount;
+
+public:
+	SoftwareOcclusion()
+	{
+		depth.assign(WIDTH * HEIGHT, 1.0f);
+		tileDepth.assign(TILES_X * TILES_Y, 1.0f);
+		triangleCount = 0;
+		generation = 0;
+		busy = 0;
+		quit = false;
+		arrived = 0;
+		pending = false;
+		ready = false;
+		enabled = false;
+		workerCount = 0;
+		rasterTime = 0.0f;
+		occludedCount = 0;
+	}
+
+	~SoftwareOcclusion()
+	{
+		Release();
+	}
+
+	//starts the worker threads, the bands are split between them
+	void Init(unsigned int threadCount)
+	{
+		threadCount = threadCount < 1 ? 1 : threadCount;
+		threadCount = threadCount > TILES_Y ? TILES_Y : threadCount;
+		workerCount = threadCount;
+		triangles.resize(threadCount);
+		finish.resize(threadCount);
+		for (unsigned int i = 0; i < threadCount; i++)
+			workers.push_back(thread(&SoftwareOcclusion::WorkerLoop, this, i));
+	}
+
+	void SetEnabled(bool enable)
+	{
+		enabled = enable;
+	}
+
+	bool IsEnabled() const
+	{
+		return enabled;
+	}
+
+	//starts collecting the occluders of a frame
+	void Begin(const glm::mat4& viewProjection)
+	{
+		Wait();
+		viewProj = viewProjection;
+		occluders.clear();
+		triangleCount = 0;
+		occludedCount = 0;
+		ready = false;
+	}
+
+	void AddOccluder(const Mesh& mesh, const glm::mat4& model)
+	{
+		Occluder occluder;
+		occluder.mesh = &mesh;
+		occluder.model = model;
+		occluder.firstTriangle = triangleCount;
+		occluders.push_back(occluder);
+		triangleCount += mesh.indices.size() / 3;
+	}
+
+	//hands the occluders to the workers and returns right away
+	void Rasterize()
+	{
+		if (!enabled || workers.empty())
+			return;
+
+		start = chrono::high_resolution_clock::now();
+		arrived = 0;
+		{
+			lock_guard<mutex> guard(lock);
+			busy = workers.size();
+			generation++;
+		}
+		pending = true;
+		ready = true;
+		wake.notify_all();
+	}
+
+	//blocks until the depth buffer of the frame is complete
+	void Wait()
+	{
+		if (!pending)
+			return;
+
+		unique_lock<mutex> guard(lock);
+		done.wait(guard, [this] { return busy == 0; });
+		pending = false;
+
+		chrono::high_resolution_clock::time_point end = finish[0];
+		for (unsigned int i = 1; i < finish.size(); i++)
+			end = finish[i] > end ? finish[i] : end;
+		rasterTime = chrono::duration<float, milli>(end - start).count();
+	}
+
+	//true unless every tile the box covers is closer than the nearest point of the box
+	bool IsVisible(unsigned int object, const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& viewPosition)
+	{
+		if (!enabled || !ready)
+			return true;
+		Wait();
+
+		float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f, minZ = 1.0f;
+		for (int i = 0; i < 8; i++)
+		{
+			glm::vec3 corner((i & 1) ? boundsMax.x : boundsMin.x, (i & 2) ? boundsMax.y : boundsMin.y, (i & 4) ? boundsMax.z : boundsMin.z);
+			glm::vec4 clip = viewProj * glm::vec4(corner, 1.0f);
+			//a corner behind the near plane, the box reaches the camera
+			if (clip.z < -clip.w)
+				return true;
+
+			float x = (clip.x / clip.w * 0.5f + 0.5f) * WIDTH;
+			float y = (clip.y / clip.w * 0.5f + 0.5f) * HEIGHT;
+			float z = clip.z / clip.w * 0.5f + 0.5f;
+			minX = min(minX, x);
+			maxX = max(maxX, x);
+			minY = min(minY, y);
+			maxY = max(maxY, y);
+			minZ = min(minZ, z);
+		}
+
+		int tx0 = max(0, (int)minX / TILE);
+		int ty0 = max(0, (int)minY / TILE);
+		int tx1 = min(TILES_X - 1, (int)maxX / TILE);
+		int ty1 = min(TILES_Y - 1, (int)maxY / TILE);
+		if (tx0 > tx1 || ty0 > ty1)
+			return true;
+
+		for (int ty = ty0; ty <= ty1; ty++)
+		{
+			for (int tx = tx0; tx <= tx1; tx++)
+			{
+				if (tileDepth[ty * TILES_X + tx] >= minZ)
+					return true;
+			}
+		}
+		occludedCount++;
+		return false;
+	}
+
+	unsigned int GetOccludedCount() const
+	{
+		return occludedCount;
+	}
+
+	unsigned int GetTriangleCount() const
+	{
+		return triangleCount;
+	}
+
+	//time from handing out the work to the last worker finishing, in milliseconds
+	float GetRasterTime() const
+	{
+		return rasterTime;
+	}
+
+	//writes the depth buffer as a binary PGM, near is black
+	bool DumpDepth(const char* path)
+	{
+		Wait();
+		FILE* file = fopen(path, "wb");
+		if (file == NULL)
+		{
+			printf("could not write %s\n", path);
+			return false;
+		}
+
+		fprintf(file, "P5\n%d %d\n255\n", WIDTH, HEIGHT);
+		vector<unsigned char> row(WIDTH);
+		for (int y = HEIGHT - 1; y >= 0; y--)
+		{
+			for (int x = 0; x < WIDTH; x++)
+				row[x] = (unsigned char)(depth[y * WIDTH + x] * 255.0f);
+			fwrite(&row[0], 1, WIDTH, file);
+		}
+		fclose(file);
+		printf("occlusion buffer written to %s\n", path);
+		return true;
+	}
+
+	//stops the worker threads
+	void Release()
+	{
+		{
+			lock_guard<mutex> guard(lock);
+			quit = true;
+		}
+		wake.notify_all();
+		for (unsigned int i = 0; i < workers.size(); i++)
+			workers[i].join();
+		workers.clear();
+	}
+
+private:
+	void WorkerLoop(unsigned int index)
+	{
+		unsigned int seen = 0;
+		while (true)
+		{
+			{
+				unique_lock<mutex> guard(lock);
+				wake.wait(guard, [&] { return quit || generation != seen; });
+				if (quit)
+					return;
+				seen = generation;
+			}
+
+			Work(index);
+			finish[index] = chrono::high_resolution_clock::now();
+
+			lock_guard<mutex> guard(lock);
+			if (--busy == 0)
+				done.notify_all();
+		}
+	}
+
+	void Work(unsigned int index)
+	{
+		unsigned int count = workerCount;
+
+		//transform and clip this worker's share of the triangles
+		triangles[index].clear();
+		unsigned int first = triangleCount * index / count;
+		unsigned int last = triangleCount * (index + 1) / count;
+		for (unsigned int o = 0; o < occluders.size(); o++)
+		{
+			const Occluder& occluder = occluders[o];
+			unsigned int meshTriangles = occluder.mesh->indices.size() / 3;
+			if (occluder.firstTriangle >= last || occluder.firstTriangle + meshTriangles <= first)
+				continue;
+
+			glm::mat4 transform = viewProj * occluder.model;
+			unsigned int t0 = first > occluder.firstTriangle ? first - occluder.firstTriangle : 0;
+			unsigned int t1 = min(meshTriangles, last - occluder.firstTriangle);
+			for (unsigned int t = t0; t < t1; t++)
+			{
+				glm::vec4 clip[3];
+				for (int v = 0; v < 3; v++)
+				{
+					const glm::vec3& position = occluder.mesh->vertices[occluder.mesh->indices[t * 3 + v]].Position;
+					clip[v] = transform * glm::vec4(position, 1.0f);
+				}
+				ClipAndSetup(clip, triangles[index]);
+			}
+		}
+
+		//every band needs the triangles of all workers
+		arrived++;
+		while (arrived < count)
+			this_thread::yield();
+
+		int bandHeight = (TILES_Y + count - 1) / count * TILE;
+		int y0 = index * bandHeight;
+		int y1 = min(HEIGHT, y0 + bandHeight);
+		if (y0 >= y1)
+			return;
+
+		fill(depth.begin() + y0 * WIDTH, depth.begin() + y1 * WIDTH, 1.0f);
+		for (unsigned int w = 0; w < count; w++)
+		{
+			for (unsigned int t = 0; t < triangles[w].size(); t++)
+				RasterizeTriangle(triangles[w][t], y0, y1);
+		}
+
+		//farthest depth per tile of the band
+		for (int ty = y0 / TILE; ty < y1 / TILE; ty++)
+		{
+			for (int tx = 0; tx < TILES_X; tx++)
+			{
+				__m128 farthest = _mm_setzero_ps();
+				for (int y = ty * TILE; y < (ty + 1) * TILE; y++)
+				{
+					const float* row = &depth[y * WIDTH + tx * TILE];
+					farthest = _mm_max_ps(farthest, _mm_max_ps(_mm_loadu_ps(row), _mm_loadu_ps(row + 4)));
+				}
+				float lanes[4];
+				_mm_storeu_ps(lanes, farthest);
+				tileDepth[ty * TILES_X + tx] = max(max(lanes[0], lanes[1]), max(lanes[2], lanes[3]));
+			}
+		}
+	}
+
+	//clips the triangle against the near plane (z >= -w) and stores the screen space result
+	void ClipAndSetup(const glm::vec4 clip[3], vector<ScreenTriangle>& result)
+	{
+		glm::vec4 polygon[4];
+		int count = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			const glm::vec4& a = clip[i];
+			const glm::vec4& b = clip[(i + 1) % 3];
+			float da = a.z + a.w;
+			float db = b.z + b.w;
+			if (da >= 0.0f)
+				polygon[count++] = a;
+			if ((da >= 0.0f) != (db >= 0.0f))
+				polygon[count++] = a + (b - a) * (da / (da - db));
+		}
+
+		for (int i = 1; i + 1 < count; i++)
+		{
+			ScreenTriangle triangle;
+			const glm::vec4* v[3] = { &polygon[0], &polygon[i], &polygon[i + 1] };
+			bool valid = true;
+			for (int k = 0; k < 3; k++)
+			{
+				if (v[k]->w <= 1e-6f)
+				{
+					valid = false;
+					break;
+				}
+				triangle.x[k] = (v[k]->x / v[k]->w * 0.5f + 0.5f) * WIDTH;
+				triangle.y[k] = (v[k]->y / v[k]->w * 0.5f + 0.5f) * HEIGHT;
+				triangle.z[k] = v[k]->z / v[k]->w * 0.5f + 0.5f;
+			}
+			if (valid)
+				result.push_back(triangle);
+		}
+	}
+
+	//half space rasterization of the rows [y0, y1), keeps the nearest depth
+	void RasterizeTriangle(const ScreenTriangle& t, int y0, int y1)
+	{
+		float x0 = t.x[0], x1 = t.x[1], x2 = t.x[2];
+		float v0 = t.y[0], v1 = t.y[1], v2 = t.y[2];
+		float z0 = t.z[0], z1 = t.z[1], z2 = t.z[2];
+		float area = (x1 - x0) * (v2 - v0) - (x2 - x0) * (v1 - v0);
+		if (fabs(area) < 1e-8f)
+			return;
+		//occluders are drawn from both sides, make the winding counter clockwise
+		if (area < 0.0f)
+		{
+			swap(x1, x2);
+			swap(v1, v2);
+			swap(z1, z2);
+			area = -area;
+		}
+
+		int minX = max(0, (int)min(x0, min(x1, x2)));
+		int maxX = min(WIDTH - 1, (int)max(x0, max(x1, x2)));
+		int minY = max(y0, (int)min(v0, min(v1, v2)));
+		int maxY = min(y1 - 1, (int)max(v0, max(v1, v2)));
+		if (minX > maxX || minY > maxY)
+			return;
+		minX &= ~3;
+
+		//edge functions e = a * x + b * y + c, positive inside
+		float a0 = v1 - v2, b0 = x2 - x1, c0 = x1 * v2 - x2 * v1;
+		float a1 = v2 - v0, b1 = x0 - x2, c1 = x2 * v0 - x0 * v2;
+		float a2 = v0 - v1, b2 = x1 - x0, c2 = x0 * v1 - x1 * v0;
+		//depth plane
+		float dzdx = ((z1 - z0) * (v2 - v0) - (z2 - z0) * (v1 - v0)) / area;
+		float dzdy = ((z2 - z0) * (x1 - x0) - (z1 - z0) * (x2 - x0)) / area;
+
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+		for (int y = minY; y <= maxY; y++)
+		{
+			float py = y + 0.5f;
+			for (int x = minX; x <= maxX; x += 4)
+			{
+				__m128 px = _mm_add_ps(_mm_set1_ps((float)x), offsets);
+				__m128 e0 = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(a0)), _mm_set1_ps(b0 * py + c0));
+				__m128 e1 = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(a1)), _mm_set1_ps(b1 * py + c1));
+				__m128 e2 = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(a2)), _mm_set1_ps(b2 * py + c2));
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+				if (_mm_movemask_ps(inside) == 0)
+					continue;
+
+				__m128 z = _mm_add_ps(_mm_set1_ps(z0 + dzdy * (py - v0)), _mm_mul_ps(_mm_sub_ps(px, _mm_set1_ps(x0)), _mm_set1_ps(dzdx)));
+				float* row = &depth[y * WIDTH + x];
+				__m128 old = _mm_loadu_ps(row);
+				__m128 nearest = _mm_min_ps(old, z);
+				_mm_storeu_ps(row, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+			}
+		}
+	}
+};
\ No newline at end of file
@@ -11,7 +11,13 @@ class TransformNode : public GroupNode
 	glm::vec3 rotation;
 	glm::vec3 scale;
 
-	static glm::mat4 transformMatrix;
+	//translation * rotation * scale, rebuilt when one of them changes
+	glm::mat4 localMatrix;
+	bool matrixDirty;
+
+	//transform nodes changed since the spatial index last looked
+	static vector<TransformNode*> moved;
+	bool inMoved;
 
 public:
 	TransformNode(const std::string& name) : GroupNode(name)
@@ -20,104 +26,65 @@ public:
 		translation = glm::vec3(0.0f);
 		rotation = glm::vec3(0.0f);
 		scale = glm::vec3(1.0f);
+		matrixDirty = true;
+		inMoved = false;
+	}
+
+	//hands over the transform nodes changed since the last call
+	static void TakeMoved(vector<TransformNode*>& result)
+	{
+		result.swap(moved);
+		moved.clear();
+		for (unsigned int i = 0; i < result.size(); i++)
+			result[i]->inMoved = false;
 	}
 
 	void SetTranslation(const glm::vec3& tr)
 	{
 		translation = tr;
+		Changed();
 	}
 
 	void SetScale(const glm::vec3& sc)
 	{
 		scale = sc;
+		Changed();
 	}
 
 	void SetRotation(const glm::vec3& rt)
 	{
 		rotation = rt;
+		Changed();
 	}
 
 	void MoveX(float delta)
 	{
 		translation.x += delta;
+		Changed();
 	}
 
-	void TraverseShadows()
-	{
-		//push
-		glm::mat4 matCopy = transformMatrix;
-
-		transformMatrix = glm::translate(transformMatrix, translation);
-		transformMatrix = glm::rotate(transformMatrix, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-		transformMatrix = glm::rotate(transformMatrix, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-		transformMatrix = glm::rotate(transformMatrix, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-		transformMatrix = glm::scale(transformMatrix, scale);
-		for (unsigned int i = 0; i < children.size(); i++)
-		{
-			children[i]->TraverseShadows();
-		}
-
-		//pop
-		transformMatrix = matCopy;
-	}
-
-	void Traverse()
+	const glm::mat4& GetLocalMatrix()
 	{
-		//push
-		glm::mat4 matCopy = transformMatrix;
-
-		transformMatrix = glm::translate(transformMatrix, translation);
-		transformMatrix = glm::rotate(transformMatrix, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-		transformMatrix = glm::rotate(transformMatrix, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-		transformMatrix = glm::rotate(transformMatrix, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-		transformMatrix = glm::scale(transformMatrix, scale);
-		for (unsigned int i = 0; i < children.size(); i++)
+		if (matrixDirty)
 		{
-			children[i]->Traverse();
+			localMatrix = glm::translate(glm::mat4(1.0f), translation);
+			localMatrix = glm::rotate(localMatrix, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+			localMatrix = glm::rotate(localMatrix, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+			localMatrix = glm::rotate(localMatrix, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+			localMatrix = glm::scale(localMatrix, scale);
+			matrixDirty = false;
 		}
-
-		//pop
-		transformMatrix = matCopy;
+		return localMatrix;
 	}
 
-	virtual void TraverseIntersection(const glm::vec3& rayOrigin, const glm::vec3& rayDirection,
-		vector<Intersection*>& hits, vector<Node*>& path)
+private:
+	void Changed()
 	{
-		//push
-		glm::mat4 matCopy = transformMatrix;
-		path.push_back(this);
-
-		transformMatrix = glm::translate(transformMatrix, translation);
-		transformMatrix = glm::rotate(transformMatrix, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-		transformMatrix = glm::rotate(transformMatrix, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-		transformMatrix = glm::rotate(transformMatrix, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-		transformMatrix = glm::scale(transformMatrix, scale);
-		for (unsigned int i = 0; i < children.size(); i++)
+		matrixDirty = true;
+		if (!inMoved)
 		{
-			children[i]->TraverseIntersection(rayOrigin, rayDirection, hits, path);
+			inMoved = true;
+			moved.push_back(this);
 		}
-		//pop
-		transformMatrix = matCopy;
-		path.pop_back();
-	}
-
-	virtual void TraverseCollisions(BoundingBox& player, const glm::vec3& velocity, vector<collision*>& collisions)
-	{
-		glm::mat4 matCopy = transformMatrix;
-		transformMatrix = glm::translate(transformMatrix, translation);
-		transformMatrix = glm::rotate(transformMatrix, glm::radians(rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
-		transformMatrix = glm::rotate(transformMatrix, glm::radians(rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
-		transformMatrix = glm::rotate(transformMatrix, glm::radians(rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
-		transformMatrix = glm::scale(transformMatrix, scale);
-
-		for (unsigned int i = 0; i < children.size(); i++) {
-			children[i]->TraverseCollisions(player, velocity, collisions);
-		}
-		transformMatrix = matCopy;
-	}
-
-	static const glm::mat4 GetTransformMatrix()
-	{
-		return transformMatrix;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,21 @@
+#version 330 core
+
+#ifdef ALPHA_TEST
+//the clear texels of cut outs leave the depth as it is, like the discard of the shading pass
+struct Material {
+    sampler2D texture_diffuse1;
+};
+
+in vec2 TexCoords;
+
+uniform Material material;
+#endif
+
+//depth only, the color writes are masked off
+void main()
+{
+#ifdef ALPHA_TEST
+    if(texture(material.texture_diffuse1, TexCoords).a < 0.5)
+        discard;
+#endif
+}
@@ -0,0 +1,33 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+#ifdef ALPHA_TEST
+//cut outs are drawn from the VAO with both streams, their texture coordinates are needed
+layout (location = 2) in vec2 aTexCoords;
+
+out vec2 TexCoords;
+#endif
+
+//index of the per draw record of the instance
+layout (location = 5) in uint aDrawID;
+
+//per draw records, the model matrix is in the first 4 texels
+uniform samplerBuffer drawData;
+
+uniform mat4 view;
+uniform mat4 proj;
+
+//the shading pass tests against this depth with GL_EQUAL, both shaders compute
+//gl_Position with the same expression from the same inputs
+invariant gl_Position;
+
+void main()
+{
+    int record = int(aDrawID) * 7;
+    mat4 model = mat4(texelFetch(drawData, record), texelFetch(drawData, record + 1),
+        texelFetch(drawData, record + 2), texelFetch(drawData, record + 3));
+    vec3 FragPos = vec3(model * vec4(aPos, 1.0));
+    gl_Position = proj * view * vec4(FragPos, 1.0);
+#ifdef ALPHA_TEST
+    TexCoords = aTexCoords;
+#endif
+}
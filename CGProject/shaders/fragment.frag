@@ -6,6 +6,10 @@ struct Material {
     sampler2D texture_specular1;    
 
     float shininess;
+    //MTL dissolve, multiplied with the alpha of the diffuse map
+    float opacity;
+    //alpha tested, the mesh is drawn with the opaque ones
+    bool cutout;
 }; 
 
 
@@ -21,70 +25,319 @@ struct PointLight {
      vec3 diffuse;
 };
 
+//the surface a light is evaluated for
+struct Surface {
+    vec3 position;
+    vec3 normal;
+    vec3 albedo;
+    vec3 specular;
+    float shininess;
+};
+
+#ifdef DEFERRED
+//full-screen lighting pass of the deferred path, the surfaces come from the G-buffer
+in vec2 TexCoords;
+
+uniform sampler2D gAlbedo;
+uniform sampler2D gNormal;
+//specular color, the shininess / 256 in alpha
+uniform sampler2D gSpecular;
+uniform sampler2D gDepth;
+uniform mat4 inverseViewProj;
+#else
 in vec3 FragPos;  
 in vec3 Normal;  
 
 in vec2 TexCoords;
+flat in int LightList;
+
+uniform Material material;
+//lists of the draws: the mask of the lamps in range and the count of the unshadowed lights
+//in the low 8 and the high 24 bits of the first entry, then the indices of the unshadowed lights
+uniform usamplerBuffer objectLights;
+#endif
   
 uniform vec3 viewPos;
-uniform Material material;
 uniform float far_plane;
 uniform float ambientlight;
 
-#define NR_POINT_LIGHTS 2
-uniform PointLight lamp[NR_POINT_LIGHTS];
-uniform samplerCube depthMap[NR_POINT_LIGHTS];
-uniform bool shadowenable[NR_POINT_LIGHTS];
-
-
-// array of offset direction for sampling
-vec3 gridSamplingDisk[20] = vec3[]
+//shadowed lamps, the first lampCount are set (ObjectLights::MAX_LAMPS, a bit each in the lamp masks)
+#define MAX_LAMPS 8
+uniform PointLight lamp[MAX_LAMPS];
+uniform int lampCount;
+uniform bool shadowenable[MAX_LAMPS];
+
+#ifdef SHADOW_ATLAS
+//every lamp samples its cube in the atlas, the same samplers for any number of lamps
+#define SHADOWED_LAMPS MAX_LAMPS
+//cube map arrays of the shadow atlas, one per resolution tier (ShadowAtlas::TIERS)
+uniform samplerCubeArrayShadow shadowAtlas[3];
+//tier and cube of the atlas slot of a lamp, the tier is -1 while it has none
+uniform ivec2 atlasSlot[MAX_LAMPS];
+#else
+//the maps of the lamps take a sampler each, the lamps past them need the atlas
+#define SHADOWED_LAMPS 2
+uniform samplerCubeShadow depthMap[SHADOWED_LAMPS];
+//lights with a dual-paraboloid map sample paraboloidMap instead of depthMap
+uniform bool paraboloid[SHADOWED_LAMPS];
+uniform sampler2DArrayShadow paraboloidMap[SHADOWED_LAMPS];
+#endif
+
+
+//taps of the full shadow kernel (1 to 20), the adaptive mode first takes ADAPTIVE_TAPS of them
+//and only takes the rest when those disagree, at the edges of the penumbras
+uniform int shadowSamples;
+uniform bool adaptiveShadows;
+
+const int ADAPTIVE_TAPS = 4;
+const float SHADOW_BIAS = 0.15;
+
+// array of offset direction for sampling, the first four are a tetrahedron so the adaptive taps
+// cover all sides
+const vec3 gridSamplingDisk[20] = vec3[]
 (
-   vec3(1, 1,  1), vec3( 1, -1,  1), vec3(-1, -1,  1), vec3(-1, 1,  1), 
-   vec3(1, 1, -1), vec3( 1, -1, -1), vec3(-1, -1, -1), vec3(-1, 1, -1),
+   vec3(1, 1,  1), vec3( 1, -1, -1), vec3(-1, 1, -1), vec3(-1, -1,  1),
+   vec3(1, -1, 1), vec3(-1, -1, -1), vec3(-1, 1,  1), vec3( 1,  1, -1),
    vec3(1, 1,  0), vec3( 1, -1,  0), vec3(-1, -1,  0), vec3(-1, 1,  0),
    vec3(1, 0,  1), vec3(-1,  0,  1), vec3( 1,  0, -1), vec3(-1, 0, -1),
    vec3(0, 1,  1), vec3( 0, -1,  1), vec3( 0, -1, -1), vec3( 0, 1, -1)
 );
 
-float ShadowCalc(vec3 fragPos, vec3 lightPos, samplerCube depthMap)
+//the cube maps compare in hardware (GL_COMPARE_REF_TO_TEXTURE), every tap returns the
+//bilinear filtered fraction of the texels that are lit
+float ShadowCalc(vec3 fragPos, vec3 lightPos, samplerCubeShadow depthMap, float diskRadius)
 {
     vec3 fragToLight = fragPos - lightPos;
 
-    float currentDepth = length(fragToLight);
+    //the maps hold the distance to the light divided by far_plane
+    float reference = (length(fragToLight) - SHADOW_BIAS) / far_plane;
+    int samples = clamp(shadowSamples, 1, 20);
 
-    float shadow = 0.0;
-    float bias = 0.15;
-    int samples = 20;
+    float lit = 0.0;
+    int taps = 0;
+    if(adaptiveShadows && samples > ADAPTIVE_TAPS)
+    {
+        for(; taps < ADAPTIVE_TAPS; ++taps)
+            lit += texture(depthMap, vec4(fragToLight + gridSamplingDisk[taps] * diskRadius, reference));
+        //fully lit or fully shadowed
+        if(lit == 0.0 || lit == float(ADAPTIVE_TAPS))
+            return 1.0 - lit / float(ADAPTIVE_TAPS);
+    }
+    for(; taps < samples; ++taps)
+        lit += texture(depthMap, vec4(fragToLight + gridSamplingDisk[taps] * diskRadius, reference));
 
-    float closestDepth;
-    float viewDistance = length(viewPos - fragPos);
-    float diskRadius = (1.0 + (viewDistance / far_plane)) / 25.0;
-    for(int i = 0; i < samples; ++i)
+    return 1.0 - lit / float(samples);
+}
+
+#ifndef SHADOW_ATLAS
+//prefiltered cube shadows, a single fetch of the blurred EVSM moments. the paraboloids and the atlas keep PCF
+uniform bool momentShadows;
+uniform samplerCube momentMap[SHADOWED_LAMPS];
+//positive and negative warp the moments were taken with
+uniform vec2 momentExponents;
+//part of the Chebyshev bound cut off against light bleeding, 0 to below 1
+uniform float lightBleeding;
+
+//minimum standard deviation of the moments in depth units, against acne on lit surfaces
+const float MIN_DEVIATION = 0.0002;
+
+float ChebyshevUpperBound(vec2 moments, float depth, float minVariance)
+{
+    if(depth <= moments.x)
+        return 1.0;
+
+    float variance = max(moments.y - moments.x * moments.x, minVariance);
+    float d = depth - moments.x;
+    float pMax = variance / (variance + d * d);
+    //the tail of the bound is where the light bleeds through, it is cut off and the rest stretched
+    return clamp((pMax - lightBleeding) / (1.0 - lightBleeding), 0.0, 1.0);
+}
+
+float MomentShadowCalc(vec3 fragPos, vec3 lightPos, samplerCube momentMap)
+{
+    vec3 fragToLight = fragPos - lightPos;
+
+    float depth = (length(fragToLight) - SHADOW_BIAS) / far_plane;
+    vec4 moments = texture(momentMap, fragToLight);
+    float positive = exp(momentExponents.x * depth);
+    float negative = -exp(-momentExponents.y * depth);
+
+    //the minimum variance follows the slope of the warps
+    vec2 deviation = MIN_DEVIATION * momentExponents * vec2(positive, -negative);
+    float lit = min(ChebyshevUpperBound(moments.xy, positive, deviation.x * deviation.x),
+        ChebyshevUpperBound(moments.zw, negative, deviation.y * deviation.y));
+
+    return 1.0 - lit;
+}
+#endif
+
+//unshadowed lights of the clustered pass, 3 texels each: position and range, diffuse, attenuation
+uniform samplerBuffer clusterLights;
+//offset and count of the light list of every cluster, and the lists one after the other
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+uniform int clusterLightCount;
+//0 loops over every light, 1 over the list of the draw and 2 over the list of the cluster.
+//the deferred pass has no draws, it takes the clusters for the lists of the draws
+uniform int lightAssignment;
+uniform ivec3 clusterDims;
+//pixels of a screen tile, and the slice of a view depth d is log(d) * x + y
+uniform vec2 clusterTileSize;
+uniform vec2 clusterSlices;
+uniform mat4 view;
+
+vec3 CalcClusterLight(int index, Surface surface, vec3 viewDir)
+{
+    vec4 positionRange = texelFetch(clusterLights, index * 3);
+    vec3 toLight = positionRange.xyz - surface.position;
+    float distance = length(toLight);
+    if(distance >= positionRange.w)
+        return vec3(0.0);
+
+    vec3 diffuseColor = texelFetch(clusterLights, index * 3 + 1).rgb;
+    vec3 attenuation = texelFetch(clusterLights, index * 3 + 2).xyz;
+
+    vec3 lightDir = toLight / distance;
+    float diff = max(dot(surface.normal, lightDir), 0.0);
+    vec3 halfwayDir = normalize(lightDir + viewDir);
+    float spec = pow(max(dot(surface.normal, halfwayDir), 0.0), surface.shininess);
+
+    //fades out towards the range, so the light does not stop at the edge of its clusters
+    float window = clamp(1.0 - pow(distance / positionRange.w, 4.0), 0.0, 1.0);
+    float falloff = window * window / (attenuation.x + attenuation.y * distance + attenuation.z * distance * distance);
+
+    return (diffuseColor * diff * surface.albedo + spec * surface.specular) * falloff;
+}
+
+vec3 CalcClusterLights(Surface surface, vec3 viewDir)
+{
+    vec3 result = vec3(0.0);
+#ifndef DEFERRED
+    if(lightAssignment == 1)
+    {
+        uint count = texelFetch(objectLights, LightList).x >> 8;
+        for(uint i = 0u; i < count; i++)
+            result += CalcClusterLight(int(texelFetch(objectLights, LightList + 1 + int(i)).x), surface, viewDir);
+        return result;
+    }
+#endif
+    if(lightAssignment == 0)
     {
-        closestDepth = texture(depthMap, fragToLight + gridSamplingDisk[i] * diskRadius).r;
-        closestDepth *= far_plane;   // undo mapping [0;1]
-        if(currentDepth - bias > closestDepth)
-            shadow += 1.0;
+        for(int i = 0; i < clusterLightCount; i++)
+            result += CalcClusterLight(i, surface, viewDir);
+        return result;
     }
-    shadow /= float(samples);
 
+    float depth = -(view * vec4(surface.position, 1.0)).z;
+    ivec3 cluster = ivec3(ivec2(gl_FragCoord.xy / clusterTileSize), int(log(max(depth, 1e-4)) * clusterSlices.x + clusterSlices.y));
+    cluster = clamp(cluster, ivec3(0), clusterDims - 1);
+    uvec2 list = texelFetch(clusterGrid, cluster.x + clusterDims.x * (cluster.y + clusterDims.y * cluster.z)).xy;
 
-    return shadow;
+    for(uint i = 0u; i < list.y; i++)
+        result += CalcClusterLight(int(texelFetch(clusterIndices, int(list.x + i)).x), surface, viewDir);
+    return result;
+}
+
+#ifdef SHADOW_ATLAS
+//ShadowCalc on the cube of a slot
+float AtlasShadowCalc(vec3 fragPos, vec3 lightPos, samplerCubeArrayShadow atlas, float cube, float diskRadius)
+{
+    vec3 fragToLight = fragPos - lightPos;
+    float reference = (length(fragToLight) - SHADOW_BIAS) / far_plane;
+    int samples = clamp(shadowSamples, 1, 20);
+
+    float lit = 0.0;
+    int taps = 0;
+    if(adaptiveShadows && samples > ADAPTIVE_TAPS)
+    {
+        for(; taps < ADAPTIVE_TAPS; ++taps)
+            lit += texture(atlas, vec4(fragToLight + gridSamplingDisk[taps] * diskRadius, cube), reference);
+        if(lit == 0.0 || lit == float(ADAPTIVE_TAPS))
+            return 1.0 - lit / float(ADAPTIVE_TAPS);
+    }
+    for(; taps < samples; ++taps)
+        lit += texture(atlas, vec4(fragToLight + gridSamplingDisk[taps] * diskRadius, cube), reference);
+
+    return 1.0 - lit / float(samples);
+}
 
+//the tier picks the sampler, the sampler arrays are only indexed with constants
+float SlotShadowCalc(vec3 fragPos, vec3 lightPos, ivec2 slot, float diskRadius)
+{
+    if(slot.x == 0)
+        return AtlasShadowCalc(fragPos, lightPos, shadowAtlas[0], float(slot.y), diskRadius);
+    if(slot.x == 1)
+        return AtlasShadowCalc(fragPos, lightPos, shadowAtlas[1], float(slot.y), diskRadius);
+    if(slot.x == 2)
+        return AtlasShadowCalc(fragPos, lightPos, shadowAtlas[2], float(slot.y), diskRadius);
+    //no slot, every one of them is taken
+    return 0.0;
+}
+#else
+//hemisphere h with its axis along +z, layer 0 is below the light and layer 1 above it
+vec3 HemisphereSpace(vec3 v, int h)
+{
+    return h == 0 ? vec3(v.x, v.z, -v.y) : vec3(v.x, -v.z, v.y);
 }
 
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir,samplerCube depthMap, bool shadowenable)
+//3x3 kernel, the corners first for the adaptive mode
+const vec2 paraboloidOffsets[9] = vec2[]
+(
+   vec2(-1, -1), vec2(1, 1), vec2(-1, 1), vec2(1, -1),
+   vec2(0, 0), vec2(-1, 0), vec2(1, 0), vec2(0, -1), vec2(0, 1)
+);
+
+float ParaboloidShadowCalc(vec3 fragPos, vec3 lightPos, sampler2DArrayShadow paraboloidMap, float diskRadius)
 {
+    vec3 fragToLight = fragPos - lightPos;
+
+    float currentDepth = length(fragToLight);
+    int h = fragToLight.y < 0.0 ? 0 : 1;
+    vec3 n = HemisphereSpace(fragToLight / currentDepth, h);
+    vec2 uv = n.xy / (1.0 + n.z) * 0.5 + 0.5;
+    float reference = (currentDepth - SHADOW_BIAS) / far_plane;
+
+    //same disk as the cube lookup, a unit of direction is about half a unit of the paraboloid near the axis
+    float radius = diskRadius * 0.5;
+    float lit = 0.0;
+    int taps = 0;
+    if(adaptiveShadows)
+    {
+        for(; taps < ADAPTIVE_TAPS; ++taps)
+            lit += texture(paraboloidMap, vec4(uv + paraboloidOffsets[taps] * radius, float(h), reference));
+        if(lit == 0.0 || lit == float(ADAPTIVE_TAPS))
+            return 1.0 - lit / float(ADAPTIVE_TAPS);
+    }
+    for(; taps < 9; ++taps)
+        lit += texture(paraboloidMap, vec4(uv + paraboloidOffsets[taps] * radius, float(h), reference));
+
+    return 1.0 - lit / 9.0;
+}
+
+//shadow of a lamp from its own maps
+float MapShadowCalc(vec3 fragPos, vec3 lightPos, samplerCubeShadow depthMap, bool paraboloid,
+    sampler2DArrayShadow paraboloidMap, samplerCube momentMap, float diskRadius)
+{
+    if(paraboloid)
+        return ParaboloidShadowCalc(fragPos, lightPos, paraboloidMap, diskRadius);
+    if(momentShadows)
+        return MomentShadowCalc(fragPos, lightPos, momentMap);
+    return ShadowCalc(fragPos, lightPos, depthMap, diskRadius);
+}
+#endif
+
+vec3 CalcPointLight(PointLight light, Surface surface, vec3 viewDir, float shadow)
+{
+    vec3 fragPos = surface.position;
     vec3 lightDir = normalize(light.position - fragPos);
 
     // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
+    float diff = max(dot(surface.normal, lightDir), 0.0);
 
     // specular shading
     //vec3 reflectDir = reflect(-lightDir, normal);
     vec3 halfwayDir = normalize(lightDir + viewDir);
-    float spec = pow(max(dot(normal, halfwayDir), 0.0), material.shininess);
+    float spec = pow(max(dot(surface.normal, halfwayDir), 0.0), surface.shininess);
 
     // attenuation
     float distance    = length(light.position - fragPos);
@@ -92,17 +345,15 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir,sa
   			     light.quadratic * (distance * distance));
                  
     // combine results
-    vec3 ambient  = light.ambient * texture(material.texture_diffuse1, TexCoords).rgb;
-    vec3 diffuse  = light.diffuse  * diff * texture(material.texture_diffuse1, TexCoords).rgb;
-    vec3 specular = spec * texture(material.texture_specular1, TexCoords).rgb;
+    vec3 ambient  = light.ambient * surface.albedo;
+    vec3 diffuse  = light.diffuse  * diff * surface.albedo;
+    vec3 specular = spec * surface.specular;
 
     ambient  *= attenuation;
     diffuse  *= attenuation;
     specular *= attenuation;
 
-    float shadow = ShadowCalc(fragPos, light.position, depthMap);
-
-    vec3 result = shadowenable ? (ambient + (1.0 - shadow)*(diffuse + specular)) : (ambient + (1.0 - shadow)*(diffuse + specular))*0.0;;
+    vec3 result = ambient + (1.0 - shadow)*(diffuse + specular);
 
 
     return result;
@@ -111,22 +362,69 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir,sa
 
 void main()
 {
-
-    vec3 norm = normalize(Normal);
+    Surface surface;
+#ifdef DEFERRED
+    float depth = texture(gDepth, TexCoords).r;
+    //nothing was drawn here, the sky is drawn after this pass
+    if(depth == 1.0)
+        discard;
+    //the transparent and sky passes test against the depth of the G-buffer
+    gl_FragDepth = depth;
+
+    vec4 position = inverseViewProj * vec4(vec3(TexCoords, depth) * 2.0 - 1.0, 1.0);
+    vec4 specular = texture(gSpecular, TexCoords);
+    surface.position = position.xyz / position.w;
+    surface.normal = normalize(texture(gNormal, TexCoords).xyz);
+    surface.albedo = texture(gAlbedo, TexCoords).rgb;
+    surface.specular = specular.rgb;
+    surface.shininess = specular.a * 256.0;
+    float alpha = 1.0;
+#else
+    vec4 diffuseColor = texture(material.texture_diffuse1, TexCoords);
+    if(material.cutout && diffuseColor.a < 0.5)
+        discard;
+    surface.position = FragPos;
+    surface.normal = normalize(Normal);
+    surface.albedo = diffuseColor.rgb;
+    surface.specular = texture(material.texture_specular1, TexCoords).rgb;
+    surface.shininess = material.shininess;
+    float alpha = diffuseColor.a * material.opacity;
+#endif
+
+    vec3 viewDir = normalize(viewPos - surface.position);
 
 
+    vec3 ambient = ambientlight * vec3(1.0,1.0,1.0);
+    vec3 result = ambient*surface.albedo;
 
+    //the PCF disk grows with the distance to the viewer, the same for every light
+    float viewDistance = length(viewPos - surface.position);
+    float diskRadius = (1.0 + (viewDistance / far_plane)) / 25.0;
 
-    vec3 viewDir = normalize(viewPos - FragPos);
-
-
-    vec3 ambient = ambientlight * vec3(1.0,1.0,1.0);
-    vec3 result = ambient*texture(material.texture_diffuse1, TexCoords).rgb;
+    //the lamps out of range of the draw are skipped, unless every light is evaluated for comparison
+    uint lampMask = ~0u;
+#ifndef DEFERRED
+    if(lightAssignment != 0)
+        lampMask = texelFetch(objectLights, LightList).x;
+#endif
+    for(int i = 0; i < SHADOWED_LAMPS; i++)
+    {
+        if(i >= lampCount)
+            break;
+        //a switched off lamp adds nothing, its map is not sampled at all
+        if(!shadowenable[i] || (lampMask & (1u << i)) == 0u)
+            continue;
+#ifdef SHADOW_ATLAS
+        float shadow = SlotShadowCalc(surface.position, lamp[i].position, atlasSlot[i], diskRadius);
+#else
+        float shadow = MapShadowCalc(surface.position, lamp[i].position, depthMap[i], paraboloid[i],
+            paraboloidMap[i], momentMap[i], diskRadius);
+#endif
+        result += CalcPointLight(lamp[i], surface, viewDir, shadow);
+    }
 
-    for(int i = 0; i < NR_POINT_LIGHTS; i++)
-        result += CalcPointLight(lamp[i], norm, FragPos, viewDir, depthMap[i], shadowenable[i]);
+    result += CalcClusterLights(surface, viewDir);
         
-    FragColor = vec4(result, 1.0);
+    //only the transparent pass has blending on
+    FragColor = vec4(result, alpha);
 } 
-
-
@@ -0,0 +1,31 @@
+#version 330 core
+//surfaces of the opaque draws for the lighting pass of the deferred path
+layout (location = 0) out vec4 gAlbedo;
+layout (location = 1) out vec4 gNormal;
+layout (location = 2) out vec4 gSpecular;
+
+struct Material {
+    sampler2D texture_diffuse1;
+    sampler2D texture_specular1;
+
+    float shininess;
+    float opacity;
+    bool cutout;
+};
+
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+
+uniform Material material;
+
+void main()
+{
+    vec4 diffuseColor = texture(material.texture_diffuse1, TexCoords);
+    if(material.cutout && diffuseColor.a < 0.5)
+        discard;
+    gAlbedo = vec4(diffuseColor.rgb, 1.0);
+    gNormal = vec4(normalize(Normal), 0.0);
+    //the shininess is at most 256
+    gSpecular = vec4(texture(material.texture_specular1, TexCoords).rgb, material.shininess / 256.0);
+}
@@ -0,0 +1,8 @@
+#version 330 core
+out vec4 FragColor;
+
+//color and depth writes are off while the boxes are tested, only the samples count
+void main()
+{
+    FragColor = vec4(1.0);
+}
\ No newline at end of file
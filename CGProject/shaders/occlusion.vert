@@ -0,0 +1,13 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+//the unit cube is stretched over the world space box of the tested object
+uniform vec3 boxMin;
+uniform vec3 boxMax;
+uniform mat4 viewProj;
+
+void main()
+{
+    vec3 position = mix(boxMin, boxMax, aPos);
+    gl_Position = viewProj * vec4(position, 1.0);
+}
\ No newline at end of file
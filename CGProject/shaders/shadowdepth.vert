@@ -1,9 +1,20 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
 
-uniform mat4 model;
+//index of the per draw record of the instance
+layout (location = 5) in uint aDrawID;
+
+//per draw records, the model matrix is in the first 4 texels
+uniform samplerBuffer drawData;
+
+//cube faces the draw touches, a bit per face
+flat out uint vFaceMask;
 
 void main()
 {
+    int record = int(aDrawID) * 7;
+    mat4 model = mat4(texelFetch(drawData, record), texelFetch(drawData, record + 1),
+        texelFetch(drawData, record + 2), texelFetch(drawData, record + 3));
+    vFaceMask = uint(texelFetch(drawData, record + 5).w);
     gl_Position = model * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,22 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+//index of the per draw record of the instance
+layout (location = 5) in uint aDrawID;
+
+//per draw records, the model matrix is in the first 4 texels
+uniform samplerBuffer drawData;
+
+//the cube face drawn by this pass, the commands only hold the casters of that face
+uniform mat4 shadowMatrix;
+
+out vec4 FragPos;
+
+void main()
+{
+    int record = int(aDrawID) * 7;
+    mat4 model = mat4(texelFetch(drawData, record), texelFetch(drawData, record + 1),
+        texelFetch(drawData, record + 2), texelFetch(drawData, record + 3));
+    FragPos = model * vec4(aPos, 1.0);
+    gl_Position = shadowMatrix * FragPos;
+}
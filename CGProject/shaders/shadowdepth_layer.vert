@@ -0,0 +1,34 @@
+#version 330 core
+#extension GL_ARB_shader_viewport_layer_array : enable
+#extension GL_AMD_vertex_shader_layer : enable
+layout (location = 0) in vec3 aPos;
+
+//index of the per draw record of the instance, six instances read the same record
+layout (location = 5) in uint aDrawID;
+
+//per draw records, the model matrix is in the first 4 texels
+uniform samplerBuffer drawData;
+
+uniform mat4 shadowMatrices[6];
+//faces left out of this pass (a bit per face)
+uniform int skipFaces;
+//layer of the first face, the cube of the light in a shadow atlas array
+uniform int firstLayer;
+
+out vec4 FragPos;
+
+void main()
+{
+    int face = gl_InstanceID % 6;
+    int record = int(aDrawID) * 7;
+    mat4 model = mat4(texelFetch(drawData, record), texelFetch(drawData, record + 1),
+        texelFetch(drawData, record + 2), texelFetch(drawData, record + 3));
+    uint faceMask = uint(texelFetch(drawData, record + 5).w) & ~uint(skipFaces);
+
+    FragPos = model * vec4(aPos, 1.0);
+    gl_Layer = firstLayer + face;
+    if ((faceMask & (1u << uint(face))) == 0u)
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0); // every vertex of the triangle outside the clip volume, nothing is rasterized
+    else
+        gl_Position = shadowMatrices[face] * FragPos;
+}
@@ -0,0 +1,45 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 facePos;
+
+//0: the depths of a shadow cube to EVSM moments, blurred along s. 1: the moments blurred along t
+uniform int stage;
+uniform int face;
+uniform samplerCube source;
+//taps on each side of the center, and a texel of the target cube in face coordinates (2 / size)
+uniform int radius;
+uniform float texelSize;
+//positive and negative warp of the depths
+uniform vec2 exponents;
+
+//major axis and the s and t axes of the face GL_TEXTURE_CUBE_MAP_POSITIVE_X + face
+const vec3 faceMajor[6] = vec3[](vec3(1, 0, 0), vec3(-1, 0, 0), vec3(0, 1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1));
+const vec3 faceS[6] = vec3[](vec3(0, 0, -1), vec3(0, 0, 1), vec3(1, 0, 0), vec3(1, 0, 0), vec3(1, 0, 0), vec3(-1, 0, 0));
+const vec3 faceT[6] = vec3[](vec3(0, -1, 0), vec3(0, -1, 0), vec3(0, 0, 1), vec3(0, 0, -1), vec3(0, -1, 0), vec3(0, -1, 0));
+
+vec4 Moments(float depth)
+{
+    float positive = exp(exponents.x * depth);
+    float negative = -exp(-exponents.y * depth);
+    return vec4(positive, positive * positive, negative, negative * negative);
+}
+
+void main()
+{
+    vec3 direction = faceMajor[face] + faceS[face] * facePos.x + faceT[face] * facePos.y;
+    vec3 step = (stage == 0 ? faceS[face] : faceT[face]) * texelSize;
+
+    //gaussian weights, the taps past the edge of the face read the neighbouring face
+    float sigma = max(float(radius), 1.0) * 0.5;
+    vec4 sum = vec4(0.0);
+    float weights = 0.0;
+    for(int i = -radius; i <= radius; i++)
+    {
+        float weight = exp(-float(i * i) / (2.0 * sigma * sigma));
+        vec3 tap = direction + step * float(i);
+        sum += weight * (stage == 0 ? Moments(texture(source, tap).r) : texture(source, tap));
+        weights += weight;
+    }
+    FragColor = sum / weights;
+}
@@ -0,0 +1,10 @@
+#version 330 core
+//one triangle over the whole viewport, facePos runs from -1 to 1 over the cube face drawn to
+out vec2 facePos;
+
+void main()
+{
+    vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    facePos = position;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
@@ -3,27 +3,42 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
+//index of the per draw record of the instance
+layout (location = 5) in uint aDrawID;
+
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+//offset of the light list of the draw
+flat out int LightList;
 
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 proj;
 
-//the normal matrix - transforming the normal vector for a vertex from local to world space 
-//(no translation and avoiding the effects of non-uniform scale)
-uniform mat3 normalMat;
+//per draw records, 7 texels each: the model matrix followed by the normal matrix,
+//the w of the last texel is the offset of the light list
+uniform samplerBuffer drawData;
+
+//must match depthprepass.vert, the shading pass runs with GL_EQUAL after the depth pre-pass
+invariant gl_Position;
 
 void main()
 {
+	int record = int(aDrawID) * 7;
+	mat4 model = mat4(texelFetch(drawData, record), texelFetch(drawData, record + 1),
+		texelFetch(drawData, record + 2), texelFetch(drawData, record + 3));
+	//the normal matrix - transforming the normal vector for a vertex from local to world space 
+	//(no translation and avoiding the effects of non-uniform scale)
+	mat3 normalMat = mat3(texelFetch(drawData, record + 4).xyz, texelFetch(drawData, record + 5).xyz,
+		texelFetch(drawData, record + 6).xyz);
+
 	//the fragment position in world space (multiplied only with the model matrix and without w component)
     FragPos = vec3(model * vec4(aPos, 1.0));
     Normal = normalMat * aNormal;
 	TexCoords = aTexCoords;
+	LightList = int(texelFetch(drawData, record + 6).w);
     
     gl_Position = proj * view * vec4(FragPos, 1.0);
 }
-